@@ -15,6 +15,7 @@
 //    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
 #include "Hasher2.h"
 
+#include <array>
 #include <new>
 #include <numeric>
 
@@ -170,6 +171,47 @@ public:
   }
 };
 
+// Appending zeros to a reflected CRC multiplies its register by x^(8n) modulo the polynomial. That takes a
+// multiplication per set bit of n with precomputed squares, instead of running the table over every byte.
+template <typename T, T Poly>
+class CrcZeros
+{
+  static constexpr T k_one = (T)1 << (sizeof(T) * 8 - 1);
+
+  static constexpr T Multiply(T a, T b)
+  {
+    T product{};
+    for (auto m = k_one; m != 0; m >>= 1)
+    {
+      if (a & m)
+        product ^= b;
+      b = b & 1 ? (b >> 1) ^ Poly : b >> 1;
+    }
+    return product;
+  }
+
+  // x^(2^i), starting from x^1, far enough for any 64 bit byte count
+  static constexpr auto k_squares = []
+  {
+    std::array<T, 3 + 64> out{};
+    out[0] = k_one >> 1;
+    for (size_t i = 1; i < out.size(); ++i)
+      out[i] = Multiply(out[i - 1], out[i - 1]);
+    return out;
+  }();
+
+public:
+  // The CRC after `size` more zero bytes, with the same inversion before and after as the table implementations
+  static T Extend(T crc, uint64_t size)
+  {
+    auto power = k_one;
+    for (size_t i = 3; size != 0; size >>= 1, ++i)
+      if (size & 1)
+        power = Multiply(k_squares[i], power);
+    return ~Multiply(power, ~crc);
+  }
+};
+
 class Crc32HashContext final : public HashContext
 {
   uint32_t crc{};
@@ -182,6 +224,11 @@ public:
     crc = crc32_fast(data, size, crc);
   }
 
+  void UpdateZeros(size_t size)
+  {
+    crc = CrcZeros<uint32_t, 0xEDB88320>::Extend(crc, size);
+  }
+
   void Finish(uint8_t* out)
   {
     out[0] = 0xFF & (crc >> 24);
@@ -208,6 +255,11 @@ public:
     crc = crc64(crc, data, size);
   }
 
+  void UpdateZeros(size_t size)
+  {
+    crc = CrcZeros<uint64_t, 0xC96C5795D7870F42>::Extend(crc, size);
+  }
+
   void Finish(uint8_t* out)
   {
     out[0] = 0xFF & (crc >> 56);
@@ -814,6 +866,25 @@ public:
   static constexpr size_t params_count = std::size(T::k_params);
 };
 
+// Only contexts with an UpdateZeros() get one in their table
+template <typename T, class = void>
+class UpdateZerosTraits
+{
+public:
+  static constexpr void (ALGORITHMS_CC* update_zeros_fn)(HashContext* ctx, size_t size) = nullptr;
+};
+
+template <typename T>
+class UpdateZerosTraits<T, std::void_t<decltype(&T::UpdateZeros)>>
+{
+  static void ALGORITHMS_CC UpdateZeros(HashContext* ctx, size_t size)
+  {
+    ((T*)ctx)->UpdateZeros(size);
+  }
+public:
+  static constexpr auto update_zeros_fn = &UpdateZeros;
+};
+
 template <typename T>
 constexpr HashAlgorithm make_algorithm(const char* name, bool is_secure)
 {
@@ -827,7 +898,8 @@ constexpr HashAlgorithm make_algorithm(const char* name, bool is_secure)
     name,
     is_secure,
     HashContextTraits<T>::params,
-    HashContextTraits<T>::params_count
+    HashContextTraits<T>::params_count,
+    UpdateZerosTraits<T>::update_zeros_fn
   };
 }
 
@@ -34,12 +34,16 @@ class HashAlgorithm
 
   using DeleteFn = void ALGORITHMS_CC(HashContext* ctx);
 
+  // Optional, same as an update with `size` zero bytes
+  using UpdateZerosFn = void ALGORITHMS_CC(HashContext* ctx, size_t size);
+
   ParamCheckFn* _param_check_fn;
   FactoryFn* _factory_fn;
   UpdateFn* _update_fn;
   FinishFn* _finish_fn;
   GetOutputSizeFn* _get_output_size_fn;
   DeleteFn* _delete_fn;
+  UpdateZerosFn* _update_zeros_fn;
 
 public:
   const char* name;
@@ -60,13 +64,15 @@ public:
     const char* name,
     bool is_secure,
     const char* const* params,
-    uint32_t params_size
+    uint32_t params_size,
+    UpdateZerosFn* update_zeros_fn = nullptr
   ) : _param_check_fn(param_check_fn)
     , _factory_fn(factory_fn)
     , _update_fn(update_fn)
     , _finish_fn(finish_fn)
     , _get_output_size_fn(get_output_size_fn)
     , _delete_fn(delete_fn)
+    , _update_zeros_fn(update_zeros_fn)
     , name(name)
     , params(params)
     , params_size(params_size)
@@ -82,13 +88,15 @@ public:
     DeleteFn* delete_fn,
     const char* name,
     bool is_secure,
-    const char* const(&params)[N]
+    const char* const(&params)[N],
+    UpdateZerosFn* update_zeros_fn = nullptr
   ) : _param_check_fn(param_check_fn)
     , _factory_fn(factory_fn)
     , _update_fn(update_fn)
     , _finish_fn(finish_fn)
     , _get_output_size_fn(get_output_size_fn)
     , _delete_fn(delete_fn)
+    , _update_zeros_fn(update_zeros_fn)
     , name(name)
     , params(params)
     , params_size(N)
@@ -138,6 +146,9 @@ public:
 
   void Update(const void* data, size_t size) { _algorithm->_update_fn(_ctx, data, size); }
   void Finish(uint8_t* out) { _algorithm->_finish_fn(_ctx, out); }
+  // Without actually going over them, if the algorithm has a shortcut for that. Check CanUpdateZeros() first.
+  bool CanUpdateZeros() const { return _algorithm->_update_zeros_fn != nullptr; }
+  void UpdateZeros(size_t size) { _algorithm->_update_zeros_fn(_ctx, size); }
   size_t GetOutputSize() const { return _algorithm->_get_output_size_fn(_ctx); }
 };
 
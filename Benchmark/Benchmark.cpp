@@ -17,30 +17,65 @@
 
 #include <Windows.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <random>
 
 #include <Hasher.h>
 
-int main() {
-  static constexpr auto k_passes = 20u;
-  // 4 MB so that it fits in (my) L2 cache
-  static constexpr auto k_size = 4ull << 20;
+#include "../OpenHashTab/Headless.h"
+#include "Benchmark.h"
 
+uint64_t* AllocateRandomData(size_t size) {
   const auto p = (uint64_t*)VirtualAlloc(
     nullptr,
-    k_size,
+    size,
     MEM_RESERVE | MEM_COMMIT,
     PAGE_READWRITE
   );
 
   if (!p) {
     printf("VirtualAlloc failed.");
-    return 1;
+    return nullptr;
   }
 
   std::mt19937_64 engine{0}; // NOLINT(cert-msc51-cpp)
-  std::generate_n(p, k_size / sizeof(*p), [&engine] { return engine(); });
+  std::generate_n(p, size / sizeof(*p), [&engine] { return engine(); });
+
+  return p;
+}
+
+std::vector<AlgorithmMix> GetAlgorithmMixes() {
+  std::vector<AlgorithmMix> mixes{
+    {"default", {"MD5", "SHA-1", "SHA-256", "SHA-512"}},
+    {"fast", {"CRC32", "XXH3-64", "XXH3-128", "BLAKE3"}},
+    {"all", {}},
+  };
+  for (const auto& algo : LegacyHashAlgorithm::Algorithms())
+    mixes.back().algorithms.push_back(algo.GetName());
+  return mixes;
+}
+
+bool ReadFileToString(const wchar_t* path, std::string& str) {
+  const auto f = _wfopen(path, L"rb");
+  if (!f)
+    return false;
+  char buf[4096];
+  size_t read;
+  while ((read = fread(buf, 1, sizeof(buf), f)) != 0)
+    str.append(buf, read);
+  fclose(f);
+  return true;
+}
+
+static int KernelBenchmark() {
+  static constexpr auto k_passes = 20u;
+  static constexpr auto k_size = k_benchmark_data_size;
+
+  const auto p = AllocateRandomData(k_size);
+  if (!p)
+    return 1;
 
   LARGE_INTEGER frequency{};
   QueryPerformanceFrequency(&frequency);
@@ -123,3 +158,100 @@ int main() {
 
   return 0;
 }
+
+// Hashes engine sized blocks with every algorithm of a mix in turn, like a hash worker does with a read block, once
+// from normal pages and once from large pages. The working set is well past the caches so the TLB gets a workout.
+static int LargePagesBenchmark() {
+  static constexpr auto k_passes = 5u;
+  static constexpr auto k_block_size = 2ull << 20;
+  static constexpr auto k_size = 128ull << 20;
+
+  const auto normal = (const uint8_t*)AllocateRandomData(k_size);
+  if (!normal)
+    return 1;
+
+  const auto large = (uint8_t*)HeadlessAllocateLargePages(k_size);
+  if (!large) {
+    printf("Can't allocate large pages, the account needs the \"Lock pages in memory\" right.\n");
+    return 1;
+  }
+  std::copy_n(normal, k_size, large);
+
+  LARGE_INTEGER frequency{};
+  QueryPerformanceFrequency(&frequency);
+
+  const auto run = [&](const uint8_t* data, const std::vector<const LegacyHashAlgorithm*>& algorithms) {
+    int64_t best = INT64_MAX;
+    for (auto i = 0u; i < k_passes; ++i) {
+      std::vector<HashBox> contexts;
+      for (const auto algorithm : algorithms)
+        contexts.push_back(algorithm->MakeContext());
+
+      LARGE_INTEGER begin{}, end{};
+      QueryPerformanceCounter(&begin);
+
+      for (auto offset = 0ull; offset < k_size; offset += k_block_size)
+        for (auto& ctx : contexts)
+          ctx.Update(data + offset, k_block_size);
+
+      volatile uint8_t sink{};
+      for (auto& ctx : contexts) {
+        uint8_t hash[LegacyHashAlgorithm::k_max_size]{};
+        ctx.Finish(hash);
+        sink = sink + hash[0];
+      }
+
+      QueryPerformanceCounter(&end);
+      best = std::min(best, end.QuadPart - begin.QuadPart);
+    }
+    return (double)(k_size * frequency.QuadPart) / (double)best / (1ll << 20); // MB/s
+  };
+
+  printf("%-8s\t%14s\t%14s\t%8s\n", "mix", "normal pages", "large pages", "gain");
+
+  for (const auto& mix : GetAlgorithmMixes()) {
+    std::vector<const LegacyHashAlgorithm*> algorithms;
+    for (const auto name : mix.algorithms)
+      if (const auto algorithm = LegacyHashAlgorithm::ByName(name))
+        algorithms.push_back(algorithm);
+
+    const auto normal_mbps = run(normal, algorithms);
+    const auto large_mbps = run(large, algorithms);
+
+    printf(
+      "%-8s\t%9.1lf MB/s\t%9.1lf MB/s\t%+7.1lf%%\n",
+      mix.name,
+      normal_mbps,
+      large_mbps,
+      (large_mbps / normal_mbps - 1.) * 100.
+    );
+  }
+
+  return 0;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+  if (argc >= 3 && 0 == wcscmp(argv[1], L"kernel") && 0 == wcscmp(argv[2], L"--large-pages"))
+    return LargePagesBenchmark();
+  if (argc < 2 || 0 == wcscmp(argv[1], L"kernel"))
+    return KernelBenchmark();
+  if (0 == wcscmp(argv[1], L"flavors"))
+    return FlavorsBenchmark();
+  if (0 == wcscmp(argv[1], L"scaling"))
+    return ScalingBenchmark(argc - 2, argv + 2);
+  if (0 == wcscmp(argv[1], L"pipeline"))
+    return PipelineBenchmark(argc - 2, argv + 2);
+  if (0 == wcscmp(argv[1], L"cache"))
+    return CacheBenchmark(argc - 2, argv + 2);
+
+  printf(
+    "Usage:\n"
+    "  Benchmark [kernel]\n"
+    "  Benchmark kernel --large-pages\n"
+    "  Benchmark flavors\n"
+    "  Benchmark scaling [options] <files or directories...>\n"
+    "  Benchmark pipeline [options] <files or directories...>\n"
+    "  Benchmark cache [options] <files or directories...>\n"
+  );
+  return 1;
+}
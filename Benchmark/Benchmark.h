@@ -0,0 +1,49 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 4 MB so that it fits in (my) L2 cache
+inline constexpr size_t k_benchmark_data_size = 4ull << 20;
+
+// Deterministic pseudorandom data, so that digests are comparable between runs
+uint64_t* AllocateRandomData(size_t size);
+
+struct AlgorithmMix {
+  const char* name;
+  std::vector<const char*> algorithms;
+};
+
+// Algorithm sets the engine benchmarks hash with
+std::vector<AlgorithmMix> GetAlgorithmMixes();
+
+// For baselines, appends the whole file to str
+bool ReadFileToString(const wchar_t* path, std::string& str);
+
+// Runs the same workload on every algorithms dll flavor this machine supports, see Flavors.cpp
+int FlavorsBenchmark();
+
+// Hashes the given files with the engine over a sweep of worker counts, see Scaling.cpp
+int ScalingBenchmark(int argc, wchar_t* argv[]);
+
+// Hashes the given files with the engine once per read mode, see Pipeline.cpp
+int PipelineBenchmark(int argc, wchar_t* argv[]);
+
+// Hashes the given files once per cache hint, next to a file that should stay cached, see Cache.cpp
+int CacheBenchmark(int argc, wchar_t* argv[]);
@@ -0,0 +1,183 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../OpenHashTab/Headless.h"
+#include "Benchmark.h"
+
+namespace {
+  struct Hint {
+    const char* name;
+    uint32_t cache_hint; // CacheHint in FileHashTask.h
+  };
+
+  constexpr Hint k_hints[]{
+    {"none", 0},
+    {"sequential", 1},
+    {"drop-behind", 2},
+  };
+
+  constexpr size_t k_chunk_size = 1 << 20;
+
+  // Stands in for another program's working set, which hashing shouldn't push out of the cache
+  bool WriteHotFile(const std::wstring& path, size_t size) {
+    const auto data = AllocateRandomData(k_benchmark_data_size);
+    if (!data)
+      return false;
+
+    const auto handle = CreateFileW(
+      path.c_str(),
+      GENERIC_WRITE,
+      FILE_SHARE_READ,
+      nullptr,
+      CREATE_ALWAYS,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr
+    );
+    auto ok = handle != INVALID_HANDLE_VALUE;
+    for (size_t written = 0; ok && written < size;) {
+      const auto chunk = (DWORD)std::min(size - written, k_benchmark_data_size);
+      DWORD done{};
+      ok = WriteFile(handle, data, chunk, &done, nullptr) && done == chunk;
+      written += chunk;
+    }
+    if (handle != INVALID_HANDLE_VALUE)
+      CloseHandle(handle);
+
+    VirtualFree(data, 0, MEM_RELEASE);
+    return ok;
+  }
+
+  // Reads the whole file through the cache, returns MB/s or 0 on failure
+  double ReadHotFile(const std::wstring& path) {
+    const auto handle = CreateFileW(
+      path.c_str(),
+      GENERIC_READ,
+      FILE_SHARE_READ,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr
+    );
+    if (handle == INVALID_HANDLE_VALUE)
+      return 0;
+
+    std::vector<uint8_t> buffer(k_chunk_size);
+
+    LARGE_INTEGER frequency{}, begin{}, end{};
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&begin);
+
+    uint64_t total{};
+    DWORD read{};
+    auto ok = true;
+    while ((ok = ReadFile(handle, buffer.data(), (DWORD)buffer.size(), &read, nullptr)) && read != 0)
+      total += read;
+
+    QueryPerformanceCounter(&end);
+    CloseHandle(handle);
+
+    const auto seconds = (double)(end.QuadPart - begin.QuadPart) / (double)frequency.QuadPart;
+    return ok && seconds > 0 ? (double)total / seconds / (1ll << 20) : 0;
+  }
+
+  int RunCache(std::vector<const wchar_t*>& files, const std::wstring& hot_path, const AlgorithmMix& mix) {
+    HeadlessJob job{};
+    job.files = files.data();
+    job.file_count = files.size();
+    job.algorithms = mix.algorithms.data();
+    job.algorithm_count = mix.algorithms.size();
+
+    printf("%-16s\t%12s\t%12s\t%12s\n", "hint", "hash MB/s", "hot before", "hot after");
+
+    for (const auto& hint : k_hints) {
+      // Twice, so that the second read is all from the cache
+      ReadHotFile(hot_path);
+      const auto before = ReadHotFile(hot_path);
+
+      job.cache_hint = hint.cache_hint;
+      HeadlessResult result{};
+      if (const auto error = HeadlessHashW(&job, &result); error != ERROR_SUCCESS) {
+        printf("Hashing failed with %lu\n", (unsigned long)error);
+        return 1;
+      }
+
+      const auto after = ReadHotFile(hot_path);
+      const auto mbps = result.seconds > 0 ? (double)result.bytes / result.seconds / (1ll << 20) : 0;
+
+      printf("%-16s\t%12.1f\t%12.1f\t%12.1f\n", hint.name, mbps, before, after);
+    }
+
+    return 0;
+  }
+} // namespace
+
+// Usage: Benchmark cache [--hot-size <MB>] [--mix <name>] <files or directories...>
+//
+// Measures how much hashing with each CacheHint pushes another program's data out of the file cache. A hot file of
+// the given size (default 256) is read until cached, the files are hashed, then the hot file is read again: the
+// slower it got, the more of it was evicted.
+//
+// Nothing here can empty the cache between hints, so use files several times larger than RAM. Otherwise the later
+// hints find the files already cached, and neither read nor evict much.
+int CacheBenchmark(int argc, wchar_t* argv[]) {
+  size_t hot_size = 256;
+  std::string mix_name = "default";
+  std::vector<const wchar_t*> files;
+
+  for (auto i = 0; i < argc; ++i) {
+    const auto has_value = i + 1 < argc;
+    if (has_value && 0 == wcscmp(argv[i], L"--hot-size"))
+      hot_size = wcstoul(argv[++i], nullptr, 10);
+    else if (has_value && 0 == wcscmp(argv[i], L"--mix")) {
+      char name[64]{};
+      WideCharToMultiByte(CP_UTF8, 0, argv[++i], -1, name, (int)std::size(name) - 1, nullptr, nullptr);
+      mix_name = name;
+    } else
+      files.push_back(argv[i]);
+  }
+
+  const auto mixes = GetAlgorithmMixes();
+  const auto mix = std::find_if(mixes.begin(), mixes.end(), [&](const AlgorithmMix& m) { return m.name == mix_name; });
+
+  if (files.empty() || hot_size == 0 || mix == mixes.end()) {
+    printf("Nothing to do.\n");
+    return 1;
+  }
+
+  wchar_t temp[MAX_PATH + 1]{};
+  if (!GetTempPathW((DWORD)std::size(temp), temp))
+    return 1;
+
+  const auto hot_path = std::wstring{temp} + L"OpenHashTabBenchmarkHot.bin";
+  if (!WriteHotFile(hot_path, hot_size << 20)) {
+    printf("Writing hot file failed.\n");
+    DeleteFileW(hot_path.c_str());
+    return 1;
+  }
+
+  const auto ret = RunCache(files, hot_path, *mix);
+
+  DeleteFileW(hot_path.c_str());
+  return ret;
+}
@@ -0,0 +1,115 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <Hasher.h>
+
+#include "Benchmark.h"
+
+int FlavorsBenchmark() {
+  static constexpr auto k_passes = 10u;
+  static constexpr auto k_size = k_benchmark_data_size;
+
+  const auto p = AllocateRandomData(k_size);
+  if (!p)
+    return 1;
+
+  std::vector<CPUFeatureLevel> flavors;
+  for (auto level = CPUFeatureLevel::CPU_None; level != CPUFeatureLevel::CPU_MAX;
+       level = (CPUFeatureLevel)((int)level + 1))
+    if (LegacyHashAlgorithm::IsFlavorSupported(level))
+      flavors.push_back(level);
+
+  if (flavors.empty()) {
+    printf("No algorithms dll flavor supported on this machine.\n");
+    return 1;
+  }
+
+  LARGE_INTEGER frequency{};
+  QueryPerformanceFrequency(&frequency);
+
+  printf("%-16s", "");
+  for (const auto flavor : flavors)
+    printf("\t%13s", LegacyHashAlgorithm::GetFlavorName(flavor));
+  printf("\n");
+
+  auto mismatches = 0u;
+
+  for (const auto& h : LegacyHashAlgorithm::Algorithms()) {
+    printf("%-16s", h.GetName());
+
+    uint8_t reference[LegacyHashAlgorithm::k_max_size]{};
+    auto have_reference = false;
+
+    for (auto i = 0u; i < flavors.size(); ++i) {
+      int64_t measurements[k_passes]{};
+      uint8_t hash[LegacyHashAlgorithm::k_max_size]{};
+      auto missing = false;
+
+      for (auto& measurement : measurements) {
+        auto ctx = h.MakeContext(flavors[i]);
+        if (!ctx.IsInitialized()) {
+          missing = true;
+          break;
+        }
+
+        LARGE_INTEGER begin{}, end{};
+        QueryPerformanceCounter(&begin);
+        ctx.Update(p, k_size);
+        ctx.Finish(hash);
+        QueryPerformanceCounter(&end);
+
+        measurement = end.QuadPart - begin.QuadPart;
+      }
+
+      if (missing) {
+        printf("\t%13s", "-");
+        continue;
+      }
+
+      // Compare against the first flavor that produced a digest, not the first column
+      if (!have_reference) {
+        std::copy_n(std::begin(hash), h.GetSize(), std::begin(reference));
+        have_reference = true;
+      }
+      const auto differs = !std::equal(std::begin(hash), std::begin(hash) + h.GetSize(), std::begin(reference));
+      if (differs)
+        ++mismatches;
+
+      std::sort(std::begin(measurements), std::end(measurements));
+      const auto median = (double)measurements[k_passes / 2];
+      const auto mbps = (double)(k_size * frequency.QuadPart) / median / (1ll << 20); // MB/s
+
+      printf("\t%7.1f MB/s%s", mbps, differs ? "!" : " ");
+    }
+
+    printf("\n");
+  }
+
+  if (mismatches) {
+    printf("%u digests differ from the first flavor with a digest, marked with !\n", mismatches);
+    return 2;
+  }
+
+  printf("All flavors produced identical digests.\n");
+  return 0;
+}
@@ -0,0 +1,447 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "../OpenHashTab/Headless.h"
+#include "../OpenHashTab/json.h"
+#include "Benchmark.h"
+
+namespace {
+  struct Variant {
+    const char* name;
+    uint32_t read_mode;       // ReadMode in FileHashTask.h
+    uint32_t block_size;      // KB, 0 picks per file
+    uint32_t small_file_size; // KB, 0 never reads inline
+    uint32_t read_ahead;      // blocks per file
+  };
+
+  constexpr Variant k_variants[]{
+    {"buffered", 1, 0, 64, 2},
+    {"buffered-2M", 1, 2048, 64, 2},  // fixed block size, as before it was picked per file
+    {"buffered-async", 1, 0, 0, 2},   // small files go through the whole pipeline too
+    {"buffered-serial", 1, 0, 64, 1}, // no read-ahead, reading and hashing take turns
+    {"mapped", 2, 0, 0, 2},
+    {"direct", 3, 0, 0, 2},
+    {"direct-serial", 3, 0, 0, 1},
+  };
+
+  struct Measurement {
+    std::string mix;
+    std::string variant;
+    double mbps{};
+    double files_per_second{};
+    // Some file failed to hash in some pass, the numbers mean nothing then
+    bool failed{};
+  };
+
+  struct Workload {
+    const wchar_t* name;
+    size_t file_count;
+    size_t file_size;
+  };
+
+  constexpr Workload k_workloads[]{
+    {L"small", 4096, 16 << 10},
+    {L"large", 4, 256 << 20},
+    {L"million", 1000000, 4 << 10},
+  };
+
+  // Where generated workloads go, empty if there's no temp directory
+  std::wstring GetWorkloadDirectory() {
+    wchar_t temp[MAX_PATH + 1]{};
+    if (!GetTempPathW((DWORD)std::size(temp), temp))
+      return {};
+    return std::wstring{temp} + L"OpenHashTabBenchmark";
+  }
+
+  void DeleteWorkload(const std::vector<std::wstring>& files) {
+    for (const auto& file : files)
+      DeleteFileW(file.c_str());
+    // Fails if something else is still in there, which we'd rather leave alone
+    RemoveDirectoryW(GetWorkloadDirectory().c_str());
+  }
+
+  // Writes the workload under the temp directory, returns the file paths or an empty list on failure
+  std::vector<std::wstring> GenerateWorkload(const Workload& workload) {
+    const auto directory = GetWorkloadDirectory();
+    if (directory.empty())
+      return {};
+
+    CreateDirectoryW(directory.c_str(), nullptr);
+
+    const auto data = AllocateRandomData(k_benchmark_data_size);
+    if (!data)
+      return {};
+
+    std::vector<std::wstring> files;
+    for (auto i = 0u; i < workload.file_count; ++i) {
+      auto path = directory + L"\\" + workload.name + std::to_wstring(i) + L".bin";
+      const auto handle = CreateFileW(
+        path.c_str(),
+        GENERIC_WRITE,
+        FILE_SHARE_READ,
+        nullptr,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY,
+        nullptr
+      );
+      if (handle == INVALID_HANDLE_VALUE)
+        break;
+      auto ok = true;
+      for (size_t written = 0; ok && written < workload.file_size;) {
+        // Vary the content between files a little, so they don't all hash the same
+        const auto chunk = (DWORD)std::min(workload.file_size - written, k_benchmark_data_size - 8);
+        DWORD done{};
+        ok = WriteFile(handle, (const char*)data + i % 8, chunk, &done, nullptr) && done == chunk;
+        written += chunk;
+      }
+      CloseHandle(handle);
+      files.push_back(std::move(path));
+      if (!ok)
+        break;
+    }
+
+    VirtualFree(data, 0, MEM_RELEASE);
+
+    if (files.size() != workload.file_count) {
+      DeleteWorkload(files);
+      return {};
+    }
+
+    return files;
+  }
+
+  bool WriteResults(const wchar_t* path, const std::vector<Measurement>& measurements) {
+    const auto f = _wfopen(path, L"wb");
+    if (!f)
+      return false;
+    // Failed measurements would make a baseline nothing can regress against
+    std::vector<const Measurement*> valid;
+    for (const auto& m : measurements)
+      if (!m.failed)
+        valid.push_back(&m);
+
+    fprintf(f, "{\n  \"results\": [\n");
+    for (auto i = 0u; i < valid.size(); ++i) {
+      const auto& m = *valid[i];
+      fprintf(
+        f,
+        "    {\"mix\": \"%s\", \"variant\": \"%s\", \"mbps\": %.3f, \"files_per_second\": %.1f}%s\n",
+        m.mix.c_str(),
+        m.variant.c_str(),
+        m.mbps,
+        m.files_per_second,
+        i + 1 == valid.size() ? "" : ","
+      );
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+  }
+
+  // Returns the number of regressed metrics, or -1 if the baseline couldn't be read. Baseline entries that can't be
+  // read or weren't measured count as regressions too, as do failed measurements.
+  int CompareToBaseline(const wchar_t* path, const std::vector<Measurement>& measurements, double tolerance) {
+    std::string str;
+    if (!ReadFileToString(path, str)) {
+      printf("Cannot read baseline %ls\n", path);
+      return -1;
+    }
+
+    json_parser parser{str.c_str()};
+    const auto root = parser.root();
+    const auto j_results = root ? json_getProperty(root, "results") : nullptr;
+    if (!j_results || json_getType(j_results) != JSON_ARRAY) {
+      printf("Malformed baseline %ls\n", path);
+      return -1;
+    }
+
+    auto regressions = 0;
+    for (auto j_child = json_getChild(j_results); j_child; j_child = json_getSibling(j_child)) {
+      const auto j_mix = json_getProperty(j_child, "mix");
+      const auto j_variant = json_getProperty(j_child, "variant");
+      if (!j_mix || json_getType(j_mix) != JSON_TEXT || !j_variant || json_getType(j_variant) != JSON_TEXT) {
+        printf("REGRESSION malformed baseline entry\n");
+        ++regressions;
+        continue;
+      }
+
+      const auto it = std::find_if(
+        measurements.begin(),
+        measurements.end(),
+        [&](const Measurement& m) { return m.mix == json_getValue(j_mix) && m.variant == json_getValue(j_variant); }
+      );
+      if (it == measurements.end()) {
+        printf("REGRESSION %s/%s not measured\n", json_getValue(j_mix), json_getValue(j_variant));
+        ++regressions;
+        continue;
+      }
+
+      if (it->failed) {
+        printf("REGRESSION %s/%s failed\n", it->mix.c_str(), it->variant.c_str());
+        ++regressions;
+        continue;
+      }
+
+      const auto check = [&](const char* metric, double actual) {
+        const auto j_expected = json_getProperty(j_child, metric);
+        if (!j_expected || (json_getType(j_expected) != JSON_REAL && json_getType(j_expected) != JSON_INTEGER)) {
+          printf("REGRESSION %s/%s %s: malformed baseline\n", it->mix.c_str(), it->variant.c_str(), metric);
+          ++regressions;
+          return;
+        }
+        const auto expected = json_getReal(j_expected);
+        if (actual < expected * (1. - tolerance)) {
+          printf(
+            "REGRESSION %s/%s %s: %.3f < %.3f\n",
+            it->mix.c_str(),
+            it->variant.c_str(),
+            metric,
+            actual,
+            expected
+          );
+          ++regressions;
+        }
+      };
+      check("mbps", it->mbps);
+      check("files_per_second", it->files_per_second);
+    }
+    return regressions;
+  }
+
+  int RunPipeline(
+    std::vector<const wchar_t*>& files,
+    unsigned passes,
+    uint32_t workers,
+    uint32_t io_backend,
+    bool numa,
+    uint32_t cancel_after,
+    const AlgorithmMix& mix,
+    std::vector<Measurement>& measurements
+  ) {
+    HeadlessJob job{};
+    job.files = files.data();
+    job.file_count = files.size();
+    job.algorithms = mix.algorithms.data();
+    job.algorithm_count = mix.algorithms.size();
+    job.workers = workers;
+    job.io_backend = io_backend;
+    if (numa) {
+      job.executor = 1;
+      job.numa = 1;
+    }
+
+    HeadlessResult result{};
+
+    // Warm up the page cache
+    if (const auto error = HeadlessHashW(&job, &result); error != ERROR_SUCCESS) {
+      printf("Hashing failed with %lu\n", (unsigned long)error);
+      return 1;
+    }
+
+    printf("%llu files, %.1f MB, mix %s\n", result.files, (double)result.bytes / (1ll << 20), mix.name);
+
+    // Only the measured passes, the warm up has to read everything
+    job.cancel_after_ms = cancel_after;
+    if (result.hole_bytes)
+      printf("%.1f MB of that in sparse file holes\n", (double)result.hole_bytes / (1ll << 20));
+
+    for (const auto& variant : k_variants) {
+      job.read_mode = variant.read_mode;
+      job.block_size = variant.block_size;
+      job.small_file_size = variant.small_file_size;
+      job.read_ahead = variant.read_ahead;
+
+      Measurement m;
+      double best_seconds = 0;
+      double worst_cancel_seconds = 0;
+      for (auto i = 0u; i < passes; ++i) {
+        if (const auto error = HeadlessHashW(&job, &result); error != ERROR_SUCCESS) {
+          printf("Hashing failed with %lu\n", (unsigned long)error);
+          return 1;
+        }
+        if (result.errors != 0)
+          m.failed = true;
+        if (i == 0 || result.seconds < best_seconds)
+          best_seconds = result.seconds;
+        worst_cancel_seconds = std::max(worst_cancel_seconds, result.cancel_seconds);
+      }
+
+      m.mix = mix.name;
+      m.variant = variant.name;
+      m.mbps = best_seconds > 0 ? (double)result.bytes / best_seconds / (1ll << 20) : 0;
+      m.files_per_second = best_seconds > 0 ? (double)result.files / best_seconds : 0;
+
+      printf(
+        "%-16s\t%12.3f MB/s\t%12.1f files/s\t%llu/%llu/%llu block hits/misses/waits%s\n",
+        variant.name,
+        m.mbps,
+        m.files_per_second,
+        result.block_hits,
+        result.block_misses,
+        result.block_waits,
+        m.failed ? "\tFAILED" : ""
+      );
+      printf(
+        "%-16s\t%llu/%llu most reading/waiting\t%llu throttled at %llu-%llu\t%.3f/%.3f s read/hash stall\n",
+        "",
+        result.max_reads_in_flight,
+        result.max_blocks_waiting,
+        result.reads_throttled,
+        result.min_stage_target,
+        result.max_stage_target,
+        result.read_stall_seconds,
+        result.hash_stall_seconds
+      );
+      if (cancel_after != 0)
+        printf("%-16s\t%.3f ms to cancel at worst\n", "", worst_cancel_seconds * 1000);
+      if (result.nodes > 1 && result.seconds > 0) {
+        printf("%-16s\t", "");
+        for (auto j = 0u; j < result.nodes; ++j)
+          printf("node %u %.3f MB/s\t", j, (double)result.node_bytes[j] / result.seconds / (1ll << 20));
+        printf("\n");
+      }
+
+      measurements.push_back(std::move(m));
+    }
+
+    return 0;
+  }
+} // namespace
+
+// Usage: Benchmark pipeline [--workers <n>] [--passes <n>] [--mix <name>] [--io <threadpool|ioring>] [--numa]
+//                           [--cancel-after <ms>] [--workload <small|large|million>] [--output <file.json>]
+//                           [--baseline <file.json>] [--tolerance <fraction>] <files or directories...>
+//
+// Hashes the files once per read mode, after warming up the page cache. This measures the engine's overhead on top
+// of the hash kernels, so use a workload that fits in RAM. The direct mode reads from the device regardless. The
+// stage counters are from the last pass: read stalls mean hashing was the bottleneck, hash stalls mean reading was.
+// Reads are throttled at a target that adjusts to those stalls, the range it moved in is shown too.
+//
+// A workload generates files in the temp directory instead, and deletes them afterwards: "small" is many 16 KB files,
+// "large" is a few 256 MB ones and "million" is a million 4 KB files, for files/s.
+//
+// With --numa, the engine runs on its own threads split by NUMA node, and each variant also shows how much every node
+// hashed per second on the last pass. Nodes are only split if the system has more than one with processors.
+//
+// With --cancel-after, every measured pass is cancelled that long after it started, and each variant also shows the
+// longest it took from cancelling to the last file finishing. Throughput is meaningless then.
+//
+// With --output, each variant's MB/s and files/s are saved, so that a later build can be compared against them with
+// --baseline on the same workload and mix. That's how a change to the per-file pipeline shows it didn't cost
+// throughput. Exits with 2 if any of them dropped more than the tolerance, if the baseline has entries that weren't
+// measured or if any file failed to hash.
+int PipelineBenchmark(int argc, wchar_t* argv[]) {
+  uint32_t workers = 0;
+  auto passes = 3u;
+  uint32_t io_backend = 0;
+  auto numa = false;
+  uint32_t cancel_after = 0;
+  auto tolerance = 0.05;
+  const wchar_t* output = nullptr;
+  const wchar_t* baseline = nullptr;
+  std::string mix_name = "default";
+  std::vector<const wchar_t*> files;
+  const Workload* workload = nullptr;
+
+  for (auto i = 0; i < argc; ++i) {
+    const auto has_value = i + 1 < argc;
+    if (has_value && 0 == wcscmp(argv[i], L"--workers"))
+      workers = (uint32_t)wcstoul(argv[++i], nullptr, 10);
+    else if (has_value && 0 == wcscmp(argv[i], L"--passes"))
+      passes = (unsigned)wcstoul(argv[++i], nullptr, 10);
+    else if (has_value && 0 == wcscmp(argv[i], L"--io"))
+      io_backend = 0 == wcscmp(argv[++i], L"ioring") ? 1 : 0;
+    else if (0 == wcscmp(argv[i], L"--numa"))
+      numa = true;
+    else if (has_value && 0 == wcscmp(argv[i], L"--cancel-after"))
+      cancel_after = (uint32_t)wcstoul(argv[++i], nullptr, 10);
+    else if (has_value && 0 == wcscmp(argv[i], L"--tolerance"))
+      tolerance = wcstod(argv[++i], nullptr);
+    else if (has_value && 0 == wcscmp(argv[i], L"--output"))
+      output = argv[++i];
+    else if (has_value && 0 == wcscmp(argv[i], L"--baseline"))
+      baseline = argv[++i];
+    else if (has_value && 0 == wcscmp(argv[i], L"--mix")) {
+      char name[64]{};
+      WideCharToMultiByte(CP_UTF8, 0, argv[++i], -1, name, (int)std::size(name) - 1, nullptr, nullptr);
+      mix_name = name;
+    } else if (has_value && 0 == wcscmp(argv[i], L"--workload")) {
+      const auto name = argv[++i];
+      for (const auto& w : k_workloads)
+        if (0 == wcscmp(name, w.name))
+          workload = &w;
+      if (!workload) {
+        printf("Unknown workload.\n");
+        return 1;
+      }
+    } else
+      files.push_back(argv[i]);
+  }
+
+  const auto mixes = GetAlgorithmMixes();
+  const auto mix = std::find_if(mixes.begin(), mixes.end(), [&](const AlgorithmMix& m) { return m.name == mix_name; });
+
+  std::vector<std::wstring> generated;
+  if (workload) {
+    generated = GenerateWorkload(*workload);
+    if (generated.empty()) {
+      printf("Generating workload failed.\n");
+      return 1;
+    }
+    for (const auto& file : generated)
+      files.push_back(file.c_str());
+  }
+
+  std::vector<Measurement> measurements;
+  auto ret = 1;
+  if (files.empty() || passes == 0 || mix == mixes.end())
+    printf("Nothing to do.\n");
+  else
+    ret = RunPipeline(files, passes, workers, io_backend, numa, cancel_after, *mix, measurements);
+
+  if (workload)
+    DeleteWorkload(generated);
+
+  if (ret != 0)
+    return ret;
+
+  if (output && !WriteResults(output, measurements)) {
+    printf("Cannot write %ls\n", output);
+    return 1;
+  }
+
+  if (baseline) {
+    const auto regressions = CompareToBaseline(baseline, measurements, tolerance);
+    if (regressions < 0)
+      return 1;
+    if (regressions > 0)
+      return 2;
+  }
+
+  const auto failed = std::any_of(measurements.begin(), measurements.end(), [](const Measurement& m) {
+    return m.failed;
+  });
+  return failed ? 2 : 0;
+}
@@ -0,0 +1,294 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#define WIN32_LEAN_AND_MEAN
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "../OpenHashTab/Headless.h"
+#include "../OpenHashTab/json.h"
+#include "Benchmark.h"
+
+namespace {
+  struct Measurement {
+    std::string mix;
+    uint32_t workers{};
+    double mbps{};
+    double efficiency{};
+    // Some file failed to hash in some pass, the numbers mean nothing then
+    bool failed{};
+  };
+
+  // 1, 2, 4, ... and the maximum itself
+  std::vector<uint32_t> GetWorkerSweep(uint32_t max_workers) {
+    std::vector<uint32_t> sweep;
+    for (uint32_t i = 1; i < max_workers; i *= 2)
+      sweep.push_back(i);
+    sweep.push_back(max_workers);
+    return sweep;
+  }
+
+  bool WriteResults(const wchar_t* path, const std::vector<Measurement>& measurements) {
+    const auto f = _wfopen(path, L"wb");
+    if (!f)
+      return false;
+    // Failed measurements would make a baseline nothing can regress against
+    std::vector<const Measurement*> valid;
+    for (const auto& m : measurements)
+      if (!m.failed)
+        valid.push_back(&m);
+
+    fprintf(f, "{\n  \"results\": [\n");
+    for (auto i = 0u; i < valid.size(); ++i) {
+      const auto& m = *valid[i];
+      fprintf(
+        f,
+        "    {\"mix\": \"%s\", \"workers\": %u, \"mbps\": %.3f, \"efficiency\": %.4f}%s\n",
+        m.mix.c_str(),
+        m.workers,
+        m.mbps,
+        m.efficiency,
+        i + 1 == valid.size() ? "" : ","
+      );
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+  }
+
+  bool IsNumber(const json_t* j) {
+    return j && (json_getType(j) == JSON_REAL || json_getType(j) == JSON_INTEGER);
+  }
+
+  // Returns the number of regressed metrics, or -1 if the baseline couldn't be read. Baseline entries that can't be
+  // read or weren't measured count as regressions too, as do failed measurements.
+  int CompareToBaseline(const wchar_t* path, const std::vector<Measurement>& measurements, double tolerance) {
+    std::string str;
+    if (!ReadFileToString(path, str)) {
+      printf("Cannot read baseline %ls\n", path);
+      return -1;
+    }
+
+    json_parser parser{str.c_str()};
+    const auto root = parser.root();
+    const auto j_results = root ? json_getProperty(root, "results") : nullptr;
+    if (!j_results || json_getType(j_results) != JSON_ARRAY) {
+      printf("Malformed baseline %ls\n", path);
+      return -1;
+    }
+
+    auto regressions = 0;
+    for (auto j_child = json_getChild(j_results); j_child; j_child = json_getSibling(j_child)) {
+      const auto j_mix = json_getProperty(j_child, "mix");
+      const auto j_workers = json_getProperty(j_child, "workers");
+      const auto j_mbps = json_getProperty(j_child, "mbps");
+      const auto j_efficiency = json_getProperty(j_child, "efficiency");
+      if (!j_mix || json_getType(j_mix) != JSON_TEXT || !j_workers || json_getType(j_workers) != JSON_INTEGER) {
+        printf("REGRESSION malformed baseline entry\n");
+        ++regressions;
+        continue;
+      }
+
+      const auto it = std::find_if(
+        measurements.begin(),
+        measurements.end(),
+        [&](const Measurement& m) {
+          return m.mix == json_getValue(j_mix) && m.workers == (uint32_t)json_getInteger(j_workers);
+        }
+      );
+      if (it == measurements.end()) {
+        printf("REGRESSION %s/%u not measured\n", json_getValue(j_mix), (unsigned)json_getInteger(j_workers));
+        ++regressions;
+        continue;
+      }
+
+      if (it->failed) {
+        printf("REGRESSION %s/%u failed\n", it->mix.c_str(), it->workers);
+        ++regressions;
+        continue;
+      }
+
+      const auto check = [&](const char* metric, const json_t* j_expected, double actual) {
+        if (!IsNumber(j_expected)) {
+          printf("REGRESSION %s/%u %s: malformed baseline\n", it->mix.c_str(), it->workers, metric);
+          ++regressions;
+          return;
+        }
+        const auto expected = json_getReal(j_expected);
+        if (actual < expected * (1. - tolerance)) {
+          printf("REGRESSION %s/%u %s: %.3f < %.3f\n", it->mix.c_str(), it->workers, metric, actual, expected);
+          ++regressions;
+        }
+      };
+      check("mbps", j_mbps, it->mbps);
+      check("efficiency", j_efficiency, it->efficiency);
+    }
+    return regressions;
+  }
+} // namespace
+
+// Usage: Benchmark scaling [--workers <max>] [--passes <n>] [--mix <name>]... [--io <threadpool|ioring>]
+//                          [--scheduler <threadpool|stealing|broadcast>] [--executor <threadpool|threads>]
+//                          [--affinity <mask>] [--output <file.json>] [--baseline <file.json>]
+//                          [--tolerance <fraction>] <files or directories...>
+//
+// The worker sweep sizes the executor, which runs IO completions and, with the thread pool scheduler, the hashing. The
+// affinity mask pins the threads executor's workers to those logical processors in turn, as with WorkerAffinity.
+//
+// Exits with 2 if any metric regressed more than the tolerance compared to the baseline, if the baseline has entries
+// that weren't measured or if any file failed to hash. With a scheduler other than
+// the thread pool, each measurement also shows how many rounds were stolen and how busy each worker was on the last
+// pass. With broadcast, workers are listed grouped by algorithm, in the order of LegacyHashAlgorithm::Algorithms().
+int ScalingBenchmark(int argc, wchar_t* argv[]) {
+  auto max_workers = (uint32_t)GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+  auto passes = 3u;
+  auto tolerance = 0.05;
+  uint32_t io_backend = 0;
+  uint32_t hash_scheduler = 0;
+  uint32_t executor = 0;
+  uint32_t worker_affinity = 0;
+  const wchar_t* output = nullptr;
+  const wchar_t* baseline = nullptr;
+  std::vector<std::string> mix_filter;
+  std::vector<const wchar_t*> files;
+
+  for (auto i = 0; i < argc; ++i) {
+    const auto has_value = i + 1 < argc;
+    if (has_value && 0 == wcscmp(argv[i], L"--workers"))
+      max_workers = (uint32_t)wcstoul(argv[++i], nullptr, 10);
+    else if (has_value && 0 == wcscmp(argv[i], L"--passes"))
+      passes = (unsigned)wcstoul(argv[++i], nullptr, 10);
+    else if (has_value && 0 == wcscmp(argv[i], L"--tolerance"))
+      tolerance = wcstod(argv[++i], nullptr);
+    else if (has_value && 0 == wcscmp(argv[i], L"--io"))
+      io_backend = 0 == wcscmp(argv[++i], L"ioring") ? 1 : 0;
+    else if (has_value && 0 == wcscmp(argv[i], L"--scheduler")) {
+      const auto name = argv[++i];
+      hash_scheduler = 0 == wcscmp(name, L"stealing") ? 1 : 0 == wcscmp(name, L"broadcast") ? 2 : 0;
+    }
+    else if (has_value && 0 == wcscmp(argv[i], L"--executor"))
+      executor = 0 == wcscmp(argv[++i], L"threads") ? 1 : 0;
+    else if (has_value && 0 == wcscmp(argv[i], L"--affinity"))
+      worker_affinity = (uint32_t)wcstoul(argv[++i], nullptr, 0);
+    else if (has_value && 0 == wcscmp(argv[i], L"--output"))
+      output = argv[++i];
+    else if (has_value && 0 == wcscmp(argv[i], L"--baseline"))
+      baseline = argv[++i];
+    else if (has_value && 0 == wcscmp(argv[i], L"--mix")) {
+      char name[64]{};
+      WideCharToMultiByte(CP_UTF8, 0, argv[++i], -1, name, (int)std::size(name) - 1, nullptr, nullptr);
+      mix_filter.emplace_back(name);
+    } else
+      files.push_back(argv[i]);
+  }
+
+  if (files.empty() || max_workers == 0 || passes == 0) {
+    printf("Nothing to do.\n");
+    return 1;
+  }
+
+  std::vector<Measurement> measurements;
+
+  for (const auto& mix : GetAlgorithmMixes()) {
+    if (!mix_filter.empty() && std::find(mix_filter.begin(), mix_filter.end(), mix.name) == mix_filter.end())
+      continue;
+
+    HeadlessJob job{};
+    job.files = files.data();
+    job.file_count = files.size();
+    job.algorithms = mix.algorithms.data();
+    job.algorithm_count = mix.algorithms.size();
+    job.io_backend = io_backend;
+    job.hash_scheduler = hash_scheduler;
+    job.executor = executor;
+    job.worker_affinity = worker_affinity;
+
+    // Warm up the page cache, so that we measure the engine and not the disk
+    HeadlessResult result{};
+    if (const auto error = HeadlessHashW(&job, &result); error != ERROR_SUCCESS) {
+      printf("Hashing failed with %lu\n", (unsigned long)error);
+      return 1;
+    }
+
+    double single_mbps = 0;
+
+    for (const auto workers : GetWorkerSweep(max_workers)) {
+      job.workers = workers;
+
+      Measurement m;
+      double best_seconds = 0;
+      for (auto i = 0u; i < passes; ++i) {
+        if (const auto error = HeadlessHashW(&job, &result); error != ERROR_SUCCESS) {
+          printf("Hashing failed with %lu\n", (unsigned long)error);
+          return 1;
+        }
+        if (result.errors != 0)
+          m.failed = true;
+        if (i == 0 || result.seconds < best_seconds)
+          best_seconds = result.seconds;
+      }
+
+      m.mix = mix.name;
+      m.workers = workers;
+      m.mbps = best_seconds > 0 ? (double)result.bytes / best_seconds / (1ll << 20) : 0;
+      if (workers == 1)
+        single_mbps = m.mbps;
+      m.efficiency = single_mbps > 0 ? m.mbps / (single_mbps * workers) : 0;
+
+      printf(
+        "%-8s\t%3u workers\t%12.3f MB/s\t%6.1f%%%s\n",
+        m.mix.c_str(),
+        m.workers,
+        m.mbps,
+        m.efficiency * 100,
+        m.failed ? "\tFAILED" : ""
+      );
+
+      if (result.hash_workers) {
+        printf("\t\t%llu steals, utilization", result.hash_steals);
+        const auto shown = std::min<size_t>(result.hash_workers, HeadlessResult::k_max_workers);
+        for (auto j = 0u; j < shown; ++j)
+          printf(" %.0f%%", result.worker_utilization[j] * 100);
+        printf("\n");
+      }
+
+      measurements.push_back(std::move(m));
+    }
+  }
+
+  if (output && !WriteResults(output, measurements)) {
+    printf("Cannot write %ls\n", output);
+    return 1;
+  }
+
+  if (baseline) {
+    const auto regressions = CompareToBaseline(baseline, measurements, tolerance);
+    if (regressions < 0)
+      return 1;
+    if (regressions > 0)
+      return 2;
+  }
+
+  const auto failed = std::any_of(measurements.begin(), measurements.end(), [](const Measurement& m) {
+    return m.failed;
+  });
+  return failed ? 2 : 0;
+}
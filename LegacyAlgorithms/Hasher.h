@@ -21,6 +21,17 @@
 
 #include "../Algorithms/Hasher2.h"
 
+enum class CPUFeatureLevel {
+  CPU_None,
+  CPU_SSE2,
+  CPU_AVX,
+  CPU_AVX2,
+  CPU_AVX512,
+  CPU_NEON,
+
+  CPU_MAX
+};
+
 class LegacyHashAlgorithm {
 public:
   static constexpr auto k_count = 31;
@@ -45,6 +56,14 @@ public:
     return Idx(ByName(name));
   }
 
+  // The algorithms dll flavor picked for this machine
+  static CPUFeatureLevel GetCPUFeatureLevel();
+
+  // Whether the given flavor exists for this architecture and can run on this machine
+  static bool IsFlavorSupported(CPUFeatureLevel level);
+
+  static const char* GetFlavorName(CPUFeatureLevel level);
+
 private:
   const char* _name;
   const char* const* _extensions;
@@ -76,4 +95,8 @@ public:
   constexpr const char* const* GetExtensions() const { return _extensions; }
 
   HashBox MakeContext() const;
+
+  // Make a context using a specific dll flavor instead of the one picked for this machine, for comparing them.
+  // Returns an uninitialized box if the flavor is not supported.
+  HashBox MakeContext(CPUFeatureLevel level) const;
 };
@@ -36,16 +36,7 @@ enum : uint32_t {
   AVX512_XGETBV_MASK = (7u << 5) | (1u << 2) | (1u << 1)
 };
 
-enum CPUFeatureLevel {
-  CPU_None,
-  CPU_SSE2,
-  CPU_AVX,
-  CPU_AVX2,
-  CPU_AVX512,
-  CPU_NEON,
-
-  CPU_MAX
-};
+using enum CPUFeatureLevel;
 
 // Returns the algorithms dll implementation to use
 static CPUFeatureLevel get_cpu_level() {
@@ -209,7 +200,7 @@ struct AlgorithmsDll {
   const HashAlgorithm* algorithms_end{};
 
   AlgorithmsDll() {
-    const auto level = get_cpu_level();
+    const auto level = LegacyHashAlgorithm::GetCPUFeatureLevel();
     algorithms_begin = get_algorithms_begin(level);
     algorithms_end = get_algorithms_end(level);
   }
@@ -317,3 +308,48 @@ LegacyHashAlgorithm::AlgorithmsType& LegacyHashAlgorithm::Algorithms() {
 HashBox LegacyHashAlgorithm::MakeContext() const {
   return _algorithm->MakeContext(_params);
 }
+
+HashBox LegacyHashAlgorithm::MakeContext(CPUFeatureLevel level) const {
+  if (!_algorithm || !IsFlavorSupported(level))
+    return {};
+  const auto begin = get_algorithms_begin(level);
+  const auto end = get_algorithms_end(level);
+  for (auto it = begin; it != end; ++it)
+    if (0 == strcmp(_algorithm->name, it->name))
+      return it->MakeContext(_params);
+  return {};
+}
+
+CPUFeatureLevel LegacyHashAlgorithm::GetCPUFeatureLevel() {
+  static const auto level = get_cpu_level();
+  return level;
+}
+
+bool LegacyHashAlgorithm::IsFlavorSupported(CPUFeatureLevel level) {
+  const auto best = GetCPUFeatureLevel();
+#if defined(_M_X64)
+  // Flavors are strict supersets of each other
+  return level >= CPU_SSE2 && level <= best && best <= CPU_AVX512;
+#else
+  return level == best && level != CPU_None;
+#endif
+}
+
+const char* LegacyHashAlgorithm::GetFlavorName(CPUFeatureLevel level) {
+  switch (level) {
+  case CPU_SSE2:
+    return "SSE2";
+  case CPU_AVX:
+    return "AVX";
+  case CPU_AVX2:
+    return "AVX2";
+  case CPU_AVX512:
+    return "AVX512";
+  case CPU_NEON:
+    return "ARM64";
+  case CPU_None:
+  case CPU_MAX:
+  default:
+    return "None";
+  }
+}
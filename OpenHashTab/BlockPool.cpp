@@ -0,0 +1,389 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "BlockPool.h"
+
+#include "utl.h"
+
+std::atomic<intptr_t> BlockPool::s_budget = 256 << 20; // Until the first UpdateBudget()
+std::atomic<intptr_t> BlockPool::s_used;
+std::atomic<uint64_t> BlockPool::s_last_shrink;
+std::atomic<BlockPool::FreeList*> BlockPool::s_free[k_max_nodes + 1][std::size(k_block_sizes)];
+std::atomic<uint64_t> BlockPool::s_releases;
+std::atomic<uint64_t> BlockPool::s_hits;
+std::atomic<uint64_t> BlockPool::s_misses;
+std::atomic<uint64_t> BlockPool::s_waits;
+std::atomic<uint64_t> BlockPool::s_large_pages;
+std::atomic<size_t> BlockPool::s_large_page_size;
+std::mutex BlockPool::s_clients_mutex;
+std::vector<size_t> BlockPool::s_client_caps;
+unsigned BlockPool::s_large_page_clients;
+
+// The block is packed into one word, so that other threads can take it from under us. Blocks are aligned to the
+// allocation granularity of 64 KB, which leaves plenty of low bits for the size class and free list.
+struct BlockPool::ThreadCache {
+  static constexpr uintptr_t k_class_mask = 0x3;
+  static constexpr uintptr_t k_list_shift = 2;
+  static constexpr uintptr_t k_list_mask = 0x1F;
+  static constexpr uintptr_t k_data_mask = ~(uintptr_t)0xFFFF;
+
+  static_assert(std::size(k_block_sizes) <= k_class_mask + 1, "size class doesn't fit");
+  static_assert(k_max_nodes <= k_list_mask, "free list doesn't fit");
+
+  // Every live cache, for whoever needs the memory back
+  static std::mutex s_mutex;
+  static std::vector<ThreadCache*> s_caches;
+
+  std::atomic<uintptr_t> packed{};
+
+  static uintptr_t Pack(const Block& block) {
+    return (uintptr_t)block.data | ClassOf(block.size) | (uintptr_t)ListOf(block.node) << k_list_shift;
+  }
+
+  static Block Unpack(uintptr_t packed) {
+    const auto list = (DWORD)(packed >> k_list_shift & k_list_mask);
+    return {
+      (uint8_t*)(packed & k_data_mask),
+      k_block_sizes[packed & k_class_mask],
+      list == k_max_nodes ? NUMA_NO_PREFERRED_NODE : list
+    };
+  }
+
+  ThreadCache() {
+    std::lock_guard lock{s_mutex};
+    s_caches.push_back(this);
+  }
+
+  // The thread is going away, someone else can have it
+  ~ThreadCache() {
+    {
+      std::lock_guard lock{s_mutex};
+      std::erase(s_caches, this);
+    }
+    if (const auto block = Unpack(packed.exchange(0)); block.data)
+      GetFreeList(block).enqueue(block.data);
+  }
+};
+
+std::mutex BlockPool::ThreadCache::s_mutex;
+std::vector<BlockPool::ThreadCache*> BlockPool::ThreadCache::s_caches;
+
+BlockPool::ThreadCache& BlockPool::GetThreadCache() {
+  thread_local ThreadCache cache;
+  return cache;
+}
+
+BlockPool::FreeList& BlockPool::GetFreeList(const Block& block) {
+  auto& slot = s_free[ListOf(block.node)][ClassOf(block.size)];
+  if (const auto list = slot.load(std::memory_order_acquire))
+    return *list;
+
+  // Whoever loses the race throws theirs away. Never freed, blocks may be put back until the process goes away.
+  auto list = new FreeList();
+  FreeList* expected = nullptr;
+  if (!slot.compare_exchange_strong(expected, list, std::memory_order_acq_rel)) {
+    delete list;
+    list = expected;
+  }
+  return *list;
+}
+
+bool BlockPool::ReleaseCached(size_t size) {
+  std::lock_guard lock{ThreadCache::s_mutex};
+  for (const auto cache : ThreadCache::s_caches) {
+    if (const auto block = cache->packed.exchange(0)) {
+      Release(ThreadCache::Unpack(block));
+      if (size != 0 && TryReserve(size))
+        return true;
+    }
+  }
+  return false;
+}
+
+size_t BlockPool::ClassOf(size_t size) {
+  const auto it = std::find(std::begin(k_block_sizes), std::end(k_block_sizes), size);
+  assert(it != std::end(k_block_sizes));
+  return (size_t)(it - std::begin(k_block_sizes));
+}
+
+void BlockPool::Release(Block block) {
+  s_releases.fetch_add(1, std::memory_order_release);
+  const auto ret = VirtualFree(block.data, 0, MEM_RELEASE);
+  (void)ret;
+  assert(ret);
+  Unreserve(block.size);
+}
+
+bool BlockPool::TryReserve(size_t size) {
+  if ((s_used += (intptr_t)size) <= s_budget.load(std::memory_order_relaxed))
+    return true;
+
+  s_used -= (intptr_t)size;
+  return false;
+}
+
+void BlockPool::Unreserve(size_t size) {
+  s_used -= (intptr_t)size;
+}
+
+bool BlockPool::TryReserveEvicting(size_t size) {
+  if (TryReserve(size))
+    return true;
+
+  // Free blocks of the wrong size or node are just wasting budget at this point
+  for (auto& node_lists : s_free)
+    for (auto i = 0u; i < std::size(k_block_sizes); ++i) {
+      const auto list = node_lists[i].load(std::memory_order_acquire);
+      uint8_t* p;
+      while (list && list->try_dequeue(p)) {
+        Release({p, k_block_sizes[i]});
+        if (TryReserve(size))
+          return true;
+      }
+    }
+
+  return ReleaseCached(size);
+}
+
+void BlockPool::ReleaseFree() {
+  for (auto& node_lists : s_free)
+    for (auto i = 0u; i < std::size(k_block_sizes); ++i) {
+      const auto list = node_lists[i].load(std::memory_order_acquire);
+      uint8_t* p;
+      while (list && list->try_dequeue(p))
+        Release({p, k_block_sizes[i]});
+    }
+
+  ReleaseCached(0);
+}
+
+void BlockPool::CheckMemoryPressure() {
+  static const auto notification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+  if (!notification)
+    return;
+
+  BOOL low{};
+  if (!QueryMemoryResourceNotification(notification, &low) || !low)
+    return;
+
+  // Give what we released some time to show up before going further
+  const auto now = GetTickCount64();
+  auto last = s_last_shrink.load(std::memory_order_relaxed);
+  if (now - last < 1000 || !s_last_shrink.compare_exchange_strong(last, now))
+    return;
+
+  auto budget = s_budget.load(std::memory_order_relaxed);
+  const auto shrunk = std::max<intptr_t>(budget / 2, k_min_budget);
+  if (s_budget.compare_exchange_strong(budget, shrunk))
+    DebugMsg("BlockPool: memory is low, budget %zd MB\n", shrunk >> 20);
+
+  ReleaseFree();
+}
+
+BlockPool::Block BlockPool::TryAllocate(size_t size, DWORD node) {
+  // A node we don't keep apart is as good as anywhere
+  if (ListOf(node) == k_max_nodes)
+    node = NUMA_NO_PREFERRED_NODE;
+
+  // Someone may take it from us at any time, so only if it's still there
+  auto& cache = GetThreadCache();
+  if (auto packed = cache.packed.load(std::memory_order_relaxed)) {
+    const auto block = ThreadCache::Unpack(packed);
+    if (block.size == size && block.node == node && cache.packed.compare_exchange_strong(packed, 0)) {
+      s_hits.fetch_add(1, std::memory_order_relaxed);
+      return block;
+    }
+  }
+
+  const auto list = FindFreeList(ListOf(node), ClassOf(size));
+  if (uint8_t* p; list && list->try_dequeue(p)) {
+    s_hits.fetch_add(1, std::memory_order_relaxed);
+    return {p, size, node};
+  }
+
+  CheckMemoryPressure();
+
+  if (TryReserveEvicting(size)) {
+    void* p = nullptr;
+
+    // Large pages are committed right away, on the node if there is enough contiguous memory there
+    const auto large_page_size = s_large_page_size.load(std::memory_order_relaxed);
+    if (large_page_size != 0 && size % large_page_size == 0) {
+      p = VirtualAllocExNuma(
+        GetCurrentProcess(),
+        nullptr,
+        size,
+        MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+        PAGE_READWRITE,
+        node
+      );
+      if (p)
+        s_large_pages.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Pages come from the node once they're first touched, which is by the read filling them. Also where we end up if
+    // physical memory is too fragmented for large pages.
+    if (!p)
+      p = VirtualAllocExNuma(
+        GetCurrentProcess(),
+        nullptr,
+        size,
+        MEM_RESERVE | MEM_COMMIT,
+        PAGE_READWRITE,
+        node
+      );
+
+    if (p) {
+      s_misses.fetch_add(1, std::memory_order_relaxed);
+      return {static_cast<uint8_t*>(p), size, node};
+    }
+
+    Unreserve(size);
+  }
+
+  s_waits.fetch_add(1, std::memory_order_relaxed);
+  return {};
+}
+
+void BlockPool::Free(Block block) {
+  // The budget shrank since we took this, let it go instead of keeping it around
+  if (s_used.load(std::memory_order_relaxed) > s_budget.load(std::memory_order_relaxed)) {
+    Release(block);
+    return;
+  }
+
+  if (block.size <= k_max_cached_size) {
+    uintptr_t empty = 0;
+    if (GetThreadCache().packed.compare_exchange_strong(empty, ThreadCache::Pack(block)))
+      return;
+  }
+  GetFreeList(block).enqueue(block.data);
+}
+
+void BlockPool::Trim() {
+  ReleaseFree();
+}
+
+void BlockPool::AddClient(size_t cap, bool large_pages) {
+  std::lock_guard lock{s_clients_mutex};
+  s_client_caps.push_back(cap ? cap : SIZE_MAX);
+  s_large_page_clients += large_pages;
+  UpdateForClients();
+}
+
+void BlockPool::RemoveClient(size_t cap, bool large_pages) {
+  std::lock_guard lock{s_clients_mutex};
+  const auto it = std::find(s_client_caps.begin(), s_client_caps.end(), cap ? cap : SIZE_MAX);
+  assert(it != s_client_caps.end());
+  if (it != s_client_caps.end())
+    s_client_caps.erase(it);
+  s_large_page_clients -= large_pages;
+  // With nobody left the budget doesn't matter until the next one sets it
+  if (s_client_caps.empty())
+    SetLargePages(false);
+  else
+    UpdateForClients();
+}
+
+void BlockPool::UpdateForClients() {
+  const auto cap = *std::max_element(s_client_caps.begin(), s_client_caps.end());
+  UpdateBudget(cap == SIZE_MAX ? 0 : cap);
+  SetLargePages(s_large_page_clients != 0);
+}
+
+void BlockPool::UpdateBudget(size_t cap) {
+  // Leave most of what's free to everyone else, we're just a cache between the disk and the hashes
+  uint64_t budget = 1ull << 30;
+  MEMORYSTATUSEX ms{};
+  ms.dwLength = sizeof(ms);
+  if (GlobalMemoryStatusEx(&ms))
+    budget = ms.ullAvailPhys / 4;
+
+  // Hitting the limit of a job we were put in fails allocations, or worse, kills us
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+  if (QueryInformationJobObject(nullptr, JobObjectExtendedLimitInformation, &limits, sizeof(limits), nullptr)) {
+    const auto flags = limits.BasicLimitInformation.LimitFlags;
+    if (flags & JOB_OBJECT_LIMIT_PROCESS_MEMORY)
+      budget = std::min<uint64_t>(budget, limits.ProcessMemoryLimit / 4);
+    if (flags & JOB_OBJECT_LIMIT_JOB_MEMORY)
+      budget = std::min<uint64_t>(budget, limits.JobMemoryLimit / 4);
+  }
+
+  // Address space is tight in 32 bit processes
+  if constexpr (sizeof(void*) == 4)
+    budget = std::min<uint64_t>(budget, 512 << 20);
+
+  if (cap)
+    budget = std::min<uint64_t>(budget, cap);
+
+  budget = std::max<uint64_t>(budget, k_min_budget);
+
+  s_budget = (intptr_t)budget;
+  DebugMsg("BlockPool: budget %llu MB\n", budget >> 20);
+}
+
+bool BlockPool::SetLargePages(bool enable) {
+  s_large_page_size = enable ? GetLargePageSize() : 0;
+  return s_large_page_size != 0;
+}
+
+size_t BlockPool::GetLargePageSize() {
+  // Only ever try once, a privilege the account doesn't have won't show up later
+  static const auto large_page_size = []() -> size_t {
+    const auto size = GetLargePageMinimum();
+    if (size == 0)
+      return 0;
+
+    HANDLE token{};
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+      return 0;
+
+    TOKEN_PRIVILEGES privileges{};
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    auto enabled = false;
+    if (LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)) {
+      // Succeeds with ERROR_NOT_ALL_ASSIGNED if the account doesn't hold the privilege
+      enabled = AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+                && GetLastError() == ERROR_SUCCESS;
+    }
+    CloseHandle(token);
+
+    DebugMsg("BlockPool: large pages %s\n", enabled ? "enabled" : "not available");
+    return enabled ? size : 0;
+  }();
+
+  return large_page_size;
+}
+
+const uint8_t* BlockPool::GetZeroBlock() {
+  // Outside the budget, as it's only one and stays around anyway
+  static const auto zeros = (const uint8_t*)VirtualAlloc(
+    nullptr,
+    std::end(k_block_sizes)[-1],
+    MEM_RESERVE | MEM_COMMIT,
+    PAGE_READONLY
+  );
+  return zeros;
+}
+
+BlockPool::Stats BlockPool::GetStats() {
+  return {
+    s_hits.load(std::memory_order_relaxed),
+    s_misses.load(std::memory_order_relaxed),
+    s_waits.load(std::memory_order_relaxed),
+    s_large_pages.load(std::memory_order_relaxed),
+  };
+}
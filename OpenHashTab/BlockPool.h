@@ -0,0 +1,170 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+#include "Queues.h"
+
+// Read buffers in a few fixed sizes. Freed blocks are kept around for the next read instead of going back to the
+// system, so that the hot path doesn't fault in and zero fresh pages all the time.
+//
+// Blocks may be asked for on a NUMA node, so that they are near the workers hashing them. Those are kept apart from
+// the rest, and only handed out again for the same node.
+//
+// Blocks that are a multiple of the large page size may be backed by large pages, so that sweeping one with every
+// algorithm doesn't miss the TLB on every 4 KB. Those can't be paged out, but they're within the budget anyway.
+class BlockPool {
+public:
+  static constexpr size_t k_block_sizes[]{
+    64 << 10,  // 64 KB
+    256 << 10, // 256 KB
+    2 << 20,   // 2 MB
+    8 << 20,   // 8 MB
+  };
+
+  // Enough for a few of the largest blocks, so that something can always be read
+  static constexpr size_t k_min_budget = 32 << 20; // 32 MB
+
+  // Nodes above this get blocks from anywhere
+  static constexpr DWORD k_max_nodes = 16;
+
+  struct Block {
+    uint8_t* data{};
+    size_t size{};
+    // NUMA node the memory was asked for on, NUMA_NO_PREFERRED_NODE for anywhere
+    DWORD node{NUMA_NO_PREFERRED_NODE};
+  };
+
+  struct Stats {
+    // Served from a free block
+    uint64_t hits;
+    // Had to get memory from the system
+    uint64_t misses;
+    // Denied because the budget ran out, the caller has to wait for someone to free a block
+    uint64_t waits;
+    // Misses that got large pages
+    uint64_t large_pages;
+  };
+
+private:
+  // Blocks up to this size may be kept by the thread that freed them. Larger ones always go to the shared list, so
+  // that a worker going idle doesn't sit on a lot of memory.
+  static constexpr size_t k_max_cached_size = 2 << 20; // 2 MB
+
+  using FreeList = moodycamel::ConcurrentQueue<uint8_t*>;
+
+  // Increasing the budget will increase memory use and reduce possibility of a slower disk clogging up the queue
+  static std::atomic<intptr_t> s_budget;
+
+  // Bytes taken by blocks, free or not, and reservations. May be over the budget after it shrank.
+  static std::atomic<intptr_t> s_used;
+
+  // GetTickCount64() of the last time we shrank because memory was low
+  static std::atomic<uint64_t> s_last_shrink;
+
+  // By node, the last one holds blocks from anywhere. Made on first use, as most are never needed.
+  static std::atomic<FreeList*> s_free[k_max_nodes + 1][std::size(k_block_sizes)];
+
+  // Blocks given back to the system so far
+  static std::atomic<uint64_t> s_releases;
+
+  static std::atomic<uint64_t> s_hits;
+  static std::atomic<uint64_t> s_misses;
+  static std::atomic<uint64_t> s_waits;
+  static std::atomic<uint64_t> s_large_pages;
+
+  // Blocks that are a multiple of this are allocated with large pages, 0 if we don't
+  static std::atomic<size_t> s_large_page_size;
+
+  // What everyone currently hashing asked for, see AddClient(). SIZE_MAX for no limit.
+  static std::mutex s_clients_mutex;
+  static std::vector<size_t> s_client_caps;
+  static unsigned s_large_page_clients;
+
+  struct ThreadCache;
+
+  static ThreadCache& GetThreadCache();
+
+  // Give blocks cached by threads back to the system until `size` fits in the budget, all of them if it's 0. Whatever
+  // empties the shared lists also does this, so that cached blocks are as reclaimable as shared ones.
+  static bool ReleaseCached(size_t size);
+
+  static size_t ClassOf(size_t size);
+
+  // Which of the free lists blocks for this node go to, and the node they actually get allocated on
+  static DWORD ListOf(DWORD node) { return node < k_max_nodes ? node : k_max_nodes; }
+
+  // nullptr if nothing was ever freed to it
+  static FreeList* FindFreeList(DWORD list, size_t size_class) {
+    return s_free[list][size_class].load(std::memory_order_acquire);
+  }
+
+  static FreeList& GetFreeList(const Block& block);
+
+  static void Release(Block block);
+
+  // Give free blocks back to the system until `size` fits in the budget
+  static bool TryReserveEvicting(size_t size);
+
+  static void ReleaseFree();
+
+  // Halve the budget if the system is low on memory, rather than pushing it into paging
+  static void CheckMemoryPressure();
+
+  // Set the budget based on available memory and the limits of the job we may be running in, at most `cap` bytes if
+  // nonzero. Called whenever a client comes or goes, what's available changes over time.
+  static void UpdateBudget(size_t cap);
+
+  // Returns false if GetLargePageSize() is 0, blocks keep using small pages then
+  static bool SetLargePages(bool enable);
+
+  // With s_clients_mutex held
+  static void UpdateForClients();
+
+public:
+  // Returns an empty block if over budget. Size must be one of k_block_sizes.
+  static Block TryAllocate(size_t size, DWORD node = NUMA_NO_PREFERRED_NODE);
+
+  static void Free(Block block);
+
+  // Take from the budget without a block, for reads that don't need one, like mapped files
+  static bool TryReserve(size_t size);
+  static void Unreserve(size_t size);
+
+  // Give every free block back to the system, including the ones cached by threads
+  static void Trim();
+
+  // Someone starting to hash, with the most memory they want the pool to use, 0 for no limit, and whether they want
+  // large pages. The budget is set for the one that wants the most, and large pages are used while anyone wants them.
+  // Remove with the same arguments once done, which sets the budget again for whoever is left.
+  static void AddClient(size_t cap, bool large_pages);
+  static void RemoveClient(size_t cap, bool large_pages);
+
+  static size_t GetBudget() { return (size_t)s_budget.load(std::memory_order_relaxed); }
+
+  // Large pages need the lock pages privilege, which this enables in the process token on first call. Returns the
+  // large page size, or 0 if the account doesn't have the privilege or the system doesn't support large pages.
+  static size_t GetLargePageSize();
+
+  // Read only zeros as large as the largest block, shared by everyone who needs to hash a hole. Never freed, nullptr if
+  // it couldn't be allocated.
+  static const uint8_t* GetZeroBlock();
+
+  static Stats GetStats();
+
+  // Changes before any block's memory goes back to the system. Whoever keeps block addresses around, like for
+  // registering them with the kernel, has to forget them when this changed, as a new block may get the same address.
+  static uint64_t GetReleaseCount() { return s_releases.load(std::memory_order_acquire); }
+};
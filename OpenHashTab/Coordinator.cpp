@@ -15,18 +15,31 @@
 //    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
 #include "Coordinator.h"
 
+#include "BlockPool.h"
 #include "FileHashTask.h"
 #include "Settings.h"
+#include "StageController.h"
 #include "utl.h"
 #include "wnd.h"
 
+std::atomic<unsigned> Coordinator::s_alive;
+
 Coordinator::Coordinator(std::list<std::wstring> files)
-    : _files_raw(std::move(files)) {}
+    : _files_raw(std::move(files)) {
+  ++s_alive;
+}
 
 Coordinator::~Coordinator() {
   Cancel();
-  while (_references != 0)
-    ;
+  for (auto references = _references.load(); references != 0; references = _references.load())
+    _references.wait(references);
+  if (_pool_client) {
+    BlockPool::RemoveClient(_budget_cap, _large_pages);
+    StageController::RemoveTarget(_stage_target);
+  }
+  // Don't sit on up to a gigabyte in Explorer after the last window closed
+  if (--s_alive == 0)
+    BlockPool::Trim();
 }
 
 void Coordinator::RegisterWindow(HWND window) {
@@ -55,6 +68,9 @@ unsigned Coordinator::Reference() {
 unsigned Coordinator::Dereference() {
   const auto references = --_references;
   DebugMsg("ref- %d\n", references);
+  // For the destructor. This only wakes by address, so it's fine if that already saw the 0 and we're gone by now.
+  if (references == 0)
+    _references.notify_all();
   return references;
 }
 
@@ -76,61 +92,122 @@ void Coordinator::AddFiles() {
       settings.algorithms[type].SetNoSave(true); // enable algorithm the sumfile is made with
     }
   }
+  _budget_cap = (size_t)settings.buffer_memory << 20;
+  _large_pages = settings.large_pages;
+  // Unless SetWorkerCount() made one already
+  if (!_executor)
+    _executor = MakeExecutor(settings, 0);
+  for (auto i = 0u; i < _executor->GetNodeCount(); ++i)
+    _io_backends.push_back(MakeIoBackend(settings.io_backend, *_executor, i, settings.io_queue_depth));
+  const auto workers = _executor->GetWorkerCount();
+  _hash_scheduler = MakeHashScheduler(settings, workers);
+  const auto hash_workers = _hash_scheduler ? _hash_scheduler->GetWorkerCount() : workers;
+  _stage_target = (size_t)settings.stage_depth * hash_workers;
+  // Other windows may be hashing, they get the largest of what all of us asked for
+  BlockPool::AddClient(_budget_cap, _large_pages);
+  StageController::AddTarget(_stage_target);
+  _pool_client = true;
   for (const auto& file : _files.files)
     AddFile(file.first, file.second);
 }
 
+unsigned Coordinator::PickNode(uint64_t size) {
+  auto node = 0u;
+  for (auto i = 1u; i < _executor->GetNodeCount(); ++i)
+    if (_node_assigned[i] < _node_assigned[node])
+      node = i;
+  // Empty files still take some work
+  _node_assigned[node] += std::max<uint64_t>(size, 1);
+  return node;
+}
+
 void Coordinator::ProcessFiles() {
   // We have 0 files, oops!
-  if (_file_tasks.empty() && _window) {
-    SendNotifyMessageW(_window, wnd::WM_USER_ALL_FILES_FINISHED, wnd::k_user_magic_wparam, 0);
+  if (_file_tasks.empty()) {
+    std::lock_guard guard{_window_mutex};
+    AllFilesFinished();
     return;
   }
-  for (const auto& task : _file_tasks) {
-    ++_files_not_finished;
+  // Count them all first, as the first ones may finish before we start the last
+  const auto order = GetStartOrder();
+  _files_not_finished += (unsigned)order.size();
+  for (const auto task : order)
     task->StartProcessing();
+}
+
+std::vector<FileHashTask*> Coordinator::GetStartOrder() const {
+  std::vector<FileHashTask*> order;
+  order.reserve(_file_tasks.size());
+  for (const auto& task : _file_tasks)
+    order.push_back(task.get());
+
+  // Sizes are the ones seen when the files were opened. Stable, so that ties keep the enumeration order.
+  switch (settings.start_order) {
+  case StartOrder_SmallestFirst:
+    std::stable_sort(order.begin(), order.end(), [](const FileHashTask* a, const FileHashTask* b) {
+      return a->GetSize() < b->GetSize();
+    });
+    break;
+  case StartOrder_LargestFirst:
+    std::stable_sort(order.begin(), order.end(), [](const FileHashTask* a, const FileHashTask* b) {
+      return a->GetSize() > b->GetSize();
+    });
+    break;
+  case StartOrder_Path:
+    std::stable_sort(order.begin(), order.end(), [](const FileHashTask* a, const FileHashTask* b) {
+      return _wcsicmp(a->GetDisplayName().c_str(), b->GetDisplayName().c_str()) < 0;
+    });
+    break;
+  case StartOrder_None:
+  default:
+    break;
   }
+
+  return order;
 }
 
 void Coordinator::Cancel(bool wait) {
   for (const auto& file : _file_tasks)
     file->SetCancelled();
 
+  // Rather than have every read in flight fill its block first. Tasks check whether they were cancelled before they
+  // look at how a read went, so the aborted ones fail with ERROR_CANCELLED like the rest.
+  for (const auto& file : _file_tasks)
+    file->AbortReads();
+
   if (wait)
-    while (_files_not_finished > 0)
-      Sleep(1);
+    for (auto not_finished = _files_not_finished.load(); not_finished != 0; not_finished = _files_not_finished.load())
+      _files_not_finished.wait(not_finished);
 }
 
 void Coordinator::FileCompletionCallback(FileHashTask* file) {
   UNREFERENCED_PARAMETER(file);
 
-  std::lock_guard guard{_window_mutex};
+  _progress.AddFile();
 
   const auto not_finished = --_files_not_finished;
 
-  if (_window && not_finished == 0)
-    SendNotifyMessageW(_window, wnd::WM_USER_ALL_FILES_FINISHED, wnd::k_user_magic_wparam, 0);
+  if (not_finished == 0) {
+    {
+      std::lock_guard guard{_window_mutex};
+      AllFilesFinished();
+    }
+    // For Cancel(), nobody waits for anything but the last one
+    _files_not_finished.notify_all();
+  }
 }
 
-void Coordinator::FileProgressCallback(uint64_t size_progress) {
-  if (_size_total == 0)
-    return;
+void Coordinator::AllFilesFinished() {
+  if (_window)
+    SendNotifyMessageW(_window, wnd::WM_USER_ALL_FILES_FINISHED, wnd::k_user_magic_wparam, 0);
+}
 
-  const auto old_progress = _size_progressed.fetch_add(size_progress);
-  const auto new_progress = old_progress + size_progress;
-  const auto old_part = old_progress * k_progress_resolution / _size_total;
-  const auto new_part = new_progress * k_progress_resolution / _size_total;
+bool Coordinator::SetWorkerCount(DWORD workers) {
+  assert(_file_tasks.empty());
+  assert(!_executor);
 
-  if (old_part != new_part) {
-    std::lock_guard guard{_window_mutex};
-    if (_window)
-      SendNotifyMessageW(
-        _window,
-        wnd::WM_USER_FILE_PROGRESS,
-        wnd::k_user_magic_wparam,
-        (LPARAM)new_part
-      );
-  }
+  _executor = MakeExecutor(settings, workers);
+  return _executor != nullptr;
 }
 
 std::pair<std::wstring, std::wstring> Coordinator::GetSumfileDefaultSavePathAndBaseName() {
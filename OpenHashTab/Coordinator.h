@@ -14,29 +14,76 @@
 //    You should have received a copy of the GNU General Public License
 //    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
+#include "Executor.h"
+#include "HashScheduler.h"
+#include "IoBackend.h"
 #include "path.h"
+#include "Progress.h"
 #include "Settings.h"
 
 class FileHashTask;
 
+// Which files are started first. Files on a device are read in the order they were started, as far as the device limits
+// allow.
+enum StartOrder : DWORD {
+  // Whatever order the files were enumerated in
+  StartOrder_None,
+  // First results come in the soonest
+  StartOrder_SmallestFirst,
+  // Big files don't end up as a long tail on one worker after everything else is done
+  StartOrder_LargestFirst,
+  // Files in the same directory are read together
+  StartOrder_Path
+};
+
 class Coordinator {
 public:
   static constexpr auto k_progress_resolution = 256u;
 
 private:
+  // Read buffers are kept around while any coordinator is alive
+  static std::atomic<unsigned> s_alive;
+
   std::list<std::wstring> _files_raw;
   ProcessedFileList _files{};
   HWND _window{};
   uint64_t _size_total{};
-  std::atomic<uint64_t> _size_progressed{};
+  // Hashing threads only add to this, the window samples it on a timer
+  ProgressAggregator _progress;
+  // Must outlive the IO backend and the tasks, as they submit to it
+  std::unique_ptr<Executor> _executor;
+  // Must outlive the tasks, as their files are bound to them. One per executor node.
+  std::vector<std::unique_ptr<IoBackend>> _io_backends;
+  // Same, nullptr if hashing runs on the thread pool
+  std::unique_ptr<HashScheduler> _hash_scheduler;
   std::list<std::unique_ptr<FileHashTask>> _file_tasks;
   std::mutex _window_mutex{};
   std::atomic<unsigned> _references{};
   std::atomic<unsigned> _files_not_finished{};
   bool _is_sumfile{};
 
+  // Bytes of the files given to each executor node, and of those hashed by now
+  uint64_t _node_assigned[Executor::k_max_nodes]{};
+  std::atomic<uint64_t> _node_hashed[Executor::k_max_nodes]{};
+
+  // Bytes of sparse file holes hashed without reading them
+  std::atomic<uint64_t> _hole_bytes{};
+
+  // What we asked the process wide BlockPool and StageController for, taken back when we go away
+  bool _pool_client{};
+  size_t _budget_cap{};
+  bool _large_pages{};
+  size_t _stage_target{};
+
   void AddFile(const std::wstring& path, const ProcessedFileList::FileInfo& fi);
 
+  // The tasks in the order settings.start_order asks for them to be started
+  std::vector<FileHashTask*> GetStartOrder() const;
+
+protected:
+  // Called with the window lock held, once the last file task finished
+  virtual void AllFilesFinished();
+
 public:
   Coordinator(std::list<std::wstring> files);
   virtual ~Coordinator();
@@ -51,7 +98,34 @@ public:
   void ProcessFiles();
   void Cancel(bool wait = true);
   void FileCompletionCallback(FileHashTask* file);
-  void FileProgressCallback(uint64_t size_progress);
+  void FileProgressCallback(uint64_t size_progress) { _progress.AddBytes(size_progress); }
+
+  // Only from one thread, see ProgressAggregator::TakeSample()
+  ProgressAggregator::Sample SampleProgress() { return _progress.TakeSample(); }
+
+  uint64_t GetSizeTotal() const { return _size_total; }
+
+  // Run hashing and IO completions on exactly `workers` threads instead of settings.worker_count. The hash scheduler,
+  // if used, gets as many threads of its own. Must be called before AddFiles(), after settings.executor is final, as
+  // tasks bind to the executor on creation.
+  bool SetWorkerCount(DWORD workers);
+
+  Executor& GetExecutor() { return *_executor; }
+
+  IoBackend& GetIoBackend(unsigned node) { return *_io_backends[node]; }
+
+  // The executor node with the least bytes to hash so far, which then gets `size` more. Only while adding files.
+  unsigned PickNode(uint64_t size);
+
+  void NodeHashed(unsigned node, uint64_t size) { _node_hashed[node].fetch_add(size, std::memory_order_relaxed); }
+
+  uint64_t GetNodeHashed(unsigned node) const { return _node_hashed[node].load(std::memory_order_relaxed); }
+
+  void HoleSkipped(uint64_t size) { _hole_bytes.fetch_add(size, std::memory_order_relaxed); }
+
+  uint64_t GetHoleBytes() const { return _hole_bytes.load(std::memory_order_relaxed); }
+
+  HashScheduler* GetHashScheduler() { return _hash_scheduler.get(); }
 
   // The window should probably only inspect files before processing or after all are done
   const std::list<std::unique_ptr<FileHashTask>>& GetFiles() const { return _file_tasks; }
@@ -96,3 +170,19 @@ public:
     delete this;
   }
 };
+
+// Used for hashing without any UI, see Headless.cpp
+class HeadlessCoordinator : public Coordinator {
+  HANDLE _finished_event{CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+
+protected:
+  void AllFilesFinished() override { SetEvent(_finished_event); }
+
+public:
+  using Coordinator::Coordinator;
+
+  ~HeadlessCoordinator() override { CloseHandle(_finished_event); }
+
+  // Returns false if the files are still being hashed after `timeout` ms
+  bool WaitForFiles(DWORD timeout = INFINITE) const { return WaitForSingleObject(_finished_event, timeout) == WAIT_OBJECT_0; }
+};
@@ -13,6 +13,16 @@
 //
 //    You should have received a copy of the GNU General Public License
 //    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
-#include "Queues.h"
+#pragma once
 
-moodycamel::ConcurrentQueue<FileHashTask*> g_read_queue;
+// Coroutine that runs as soon as it's called and frees itself when it returns. Nobody can wait for it, so it has to
+// report what it did some other way. Awaitables resume it on whatever thread made what they wait for happen.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
@@ -0,0 +1,158 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "Device.h"
+
+// Opens the volume the file is on without any access, INVALID_HANDLE_VALUE if it has none we can open
+static HANDLE OpenVolume(HANDLE file) {
+  // \\?\Volume{00000000-0000-0000-0000-000000000000}\path\to\file
+  const auto path = std::make_unique<wchar_t[]>(PATHCCH_MAX_CCH);
+  const auto len = GetFinalPathNameByHandleW(file, path.get(), PATHCCH_MAX_CCH, VOLUME_NAME_GUID);
+  if (len == 0 || len >= PATHCCH_MAX_CCH)
+    return INVALID_HANDLE_VALUE;
+
+  // Network shares and such don't have a volume GUID path
+  const std::wstring_view volume{path.get(), len};
+  if (!volume.starts_with(L"\\\\?\\Volume{"))
+    return INVALID_HANDLE_VALUE;
+
+  const auto end = volume.find(L'\\', 4);
+  if (end == std::wstring_view::npos)
+    return INVALID_HANDLE_VALUE;
+
+  // No trailing slash, that would open the root directory instead of the volume
+  const std::wstring volume_path{volume.substr(0, end)};
+
+  // Querying properties doesn't need any access, so this works without elevation
+  return CreateFileW(
+    volume_path.c_str(),
+    0,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+    nullptr,
+    OPEN_EXISTING,
+    0,
+    nullptr
+  );
+}
+
+static DeviceClass QueryDeviceClass(HANDLE volume) {
+  STORAGE_PROPERTY_QUERY query{};
+  query.PropertyId = StorageDeviceSeekPenaltyProperty;
+  query.QueryType = PropertyStandardQuery;
+
+  DEVICE_SEEK_PENALTY_DESCRIPTOR descriptor{};
+  DWORD returned{};
+
+  // Fails for volumes spanning multiple disks, and for drivers that don't know about it on Windows 7
+  const auto ret = DeviceIoControl(
+    volume,
+    IOCTL_STORAGE_QUERY_PROPERTY,
+    &query,
+    sizeof(query),
+    &descriptor,
+    sizeof(descriptor),
+    &returned,
+    nullptr
+  );
+
+  if (!ret || returned < sizeof(descriptor))
+    return DeviceClass_Unknown;
+
+  return descriptor.IncursSeekPenalty ? DeviceClass_Rotational : DeviceClass_SolidState;
+}
+
+// Identifies the disk the volume is on, so that partitions of the same disk share a queue. Volumes spanning multiple
+// disks have no number, those get one of their own by volume serial.
+static uint64_t QueryDeviceKey(HANDLE volume, DWORD volume_serial) {
+  STORAGE_DEVICE_NUMBER number{};
+  DWORD returned{};
+  const auto ret = DeviceIoControl(
+    volume,
+    IOCTL_STORAGE_GET_DEVICE_NUMBER,
+    nullptr,
+    0,
+    &number,
+    sizeof(number),
+    &returned,
+    nullptr
+  );
+
+  if (!ret || returned < sizeof(number))
+    return volume_serial;
+
+  return 1ull << 63 | (uint64_t)number.DeviceType << 32 | number.DeviceNumber;
+}
+
+// Past this many disks, new ones share the last one's queue. Nobody hashes files on this many drives at once.
+static constexpr size_t k_max_devices = 256;
+
+static std::unique_ptr<DeviceInfo> s_devices[k_max_devices];
+static std::atomic<size_t> s_device_count;
+
+DeviceInfo& GetDeviceInfo(HANDLE file, DWORD volume_serial) {
+  static std::mutex mutex;
+  // Volumes we've seen, so that only the first file on each has to open it
+  static std::unordered_map<DWORD, size_t> volume_indices;
+  static std::unordered_map<uint64_t, size_t> device_indices;
+
+  {
+    std::lock_guard lock{mutex};
+    if (const auto it = volume_indices.find(volume_serial); it != volume_indices.end())
+      return *s_devices[it->second];
+  }
+
+  // Query without the lock, it may take a while for a sleeping disk. If we race someone, the first one wins.
+  auto device_class = DeviceClass_Unknown;
+  uint64_t key = volume_serial;
+  if (const auto volume = OpenVolume(file); volume != INVALID_HANDLE_VALUE) {
+    device_class = QueryDeviceClass(volume);
+    key = QueryDeviceKey(volume, volume_serial);
+    CloseHandle(volume);
+  }
+
+  std::lock_guard lock{mutex};
+  if (const auto it = volume_indices.find(volume_serial); it != volume_indices.end())
+    return *s_devices[it->second];
+
+  // Another partition of a disk we already know
+  if (const auto it = device_indices.find(key); it != device_indices.end()) {
+    volume_indices.emplace(volume_serial, it->second);
+    return *s_devices[it->second];
+  }
+
+  const auto count = s_device_count.load(std::memory_order_relaxed);
+  if (count == k_max_devices)
+    return *s_devices[k_max_devices - 1];
+
+  auto& device = s_devices[count];
+  device = std::make_unique<DeviceInfo>();
+  device->volume_serial = volume_serial;
+  device->device_class = device_class;
+  volume_indices.emplace(volume_serial, count);
+  device_indices.emplace(key, count);
+
+  // Publish only after the entry is complete
+  s_device_count.store(count + 1, std::memory_order_release);
+  return *device;
+}
+
+size_t GetDeviceCount() {
+  return s_device_count.load(std::memory_order_acquire);
+}
+
+DeviceInfo& GetDevice(size_t index) {
+  assert(index < GetDeviceCount());
+  return *s_devices[index];
+}
@@ -0,0 +1,54 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+#include "Queues.h"
+
+class FileHashTask;
+
+enum DeviceClass : DWORD {
+  DeviceClass_Unknown,
+  // Has a seek penalty, so reads should be large and few at a time
+  DeviceClass_Rotational,
+  DeviceClass_SolidState
+};
+
+struct DeviceInfo {
+  // Of the first volume seen on the disk
+  DWORD volume_serial{};
+  DeviceClass device_class{};
+
+  // Files on this device waiting for a block to read into
+  moodycamel::ConcurrentQueue<FileHashTask*> read_queue;
+
+  // Part of the allocation budget held by files on this device
+  std::atomic<intptr_t> bytes_in_flight{};
+
+  // Only used when the number of files read at once is limited, see FileHashTask::TryAdmit
+  std::mutex admission_mutex;
+  size_t active_files{};
+  // Files that passed their place on early while their last blocks are being read and hashed, at most one
+  size_t draining_files{};
+  std::deque<FileHashTask*> pending_files;
+};
+
+// Describes the disk the file is on, shared by all of its partitions. Only the first file seen on a volume is used for
+// querying, the result is kept for the lifetime of the process and later calls with the same serial just look it up.
+DeviceInfo& GetDeviceInfo(HANDLE file, DWORD volume_serial);
+
+// Every device seen so far, in the order they were first seen. Indices below the count are always valid.
+size_t GetDeviceCount();
+DeviceInfo& GetDevice(size_t index);
@@ -0,0 +1,361 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "Executor.h"
+
+#include "Queues.h"
+#include "Settings.h"
+
+namespace {
+  class ThreadPoolWork : public ExecutorWork {
+    PTP_WORK _work{};
+    ExecutorFn* _fn;
+    void* _ctx;
+
+    static VOID NTAPI Callback(_Inout_ PTP_CALLBACK_INSTANCE instance, _Inout_opt_ PVOID ctx, _Inout_ PTP_WORK work) {
+      UNREFERENCED_PARAMETER(instance);
+      UNREFERENCED_PARAMETER(work);
+      const auto self = static_cast<ThreadPoolWork*>(ctx);
+      self->_fn(self->_ctx);
+    }
+
+  public:
+    ThreadPoolWork(ExecutorFn* fn, void* ctx)
+        : _fn(fn)
+        , _ctx(ctx) {}
+
+    ~ThreadPoolWork() override {
+      if (_work)
+        CloseThreadpoolWork(_work);
+    }
+
+    bool Create(PTP_CALLBACK_ENVIRON environ) {
+      _work = CreateThreadpoolWork(Callback, this, environ);
+      return _work != nullptr;
+    }
+
+    void Submit() override { SubmitThreadpoolWork(_work); }
+  };
+
+  class ThreadPoolExecutor : public Executor {
+    struct OneOff {
+      ExecutorFn* fn;
+      void* ctx;
+    };
+
+    // Private pool if the worker count was pinned, otherwise we use the process default pool
+    PTP_POOL _threadpool{};
+    TP_CALLBACK_ENVIRON _callback_environ{};
+    unsigned _worker_count{};
+
+    static VOID NTAPI OneOffCallback(_Inout_ PTP_CALLBACK_INSTANCE instance, _Inout_opt_ PVOID ctx) {
+      UNREFERENCED_PARAMETER(instance);
+      const std::unique_ptr<OneOff> one_off{static_cast<OneOff*>(ctx)};
+      one_off->fn(one_off->ctx);
+    }
+
+    PTP_CALLBACK_ENVIRON GetCallbackEnviron() { return _threadpool ? &_callback_environ : nullptr; }
+
+  public:
+    ~ThreadPoolExecutor() override {
+      if (_threadpool) {
+        DestroyThreadpoolEnvironment(&_callback_environ);
+        CloseThreadpool(_threadpool);
+      }
+    }
+
+    bool Initialize(unsigned workers) {
+      _worker_count = workers ? workers : std::thread::hardware_concurrency();
+      if (workers == 0)
+        return true;
+
+      _threadpool = CreateThreadpool(nullptr);
+      if (!_threadpool)
+        return false;
+
+      SetThreadpoolThreadMaximum(_threadpool, workers);
+      if (!SetThreadpoolThreadMinimum(_threadpool, workers)) {
+        CloseThreadpool(_threadpool);
+        _threadpool = nullptr;
+        return false;
+      }
+
+      InitializeThreadpoolEnvironment(&_callback_environ);
+      SetThreadpoolCallbackPool(&_callback_environ, _threadpool);
+      return true;
+    }
+
+    std::unique_ptr<ExecutorWork> CreateWork(ExecutorFn* fn, void* ctx, unsigned node) override {
+      UNREFERENCED_PARAMETER(node);
+      auto work = std::make_unique<ThreadPoolWork>(fn, ctx);
+      if (!work->Create(GetCallbackEnviron()))
+        return nullptr;
+      return work;
+    }
+
+    void Submit(ExecutorFn* fn, void* ctx, unsigned node) override {
+      UNREFERENCED_PARAMETER(node);
+      const auto one_off = new (std::nothrow) OneOff{fn, ctx};
+      if (one_off && TrySubmitThreadpoolCallback(OneOffCallback, one_off, GetCallbackEnviron()))
+        return;
+      delete one_off;
+      fn(ctx);
+    }
+
+    std::unique_ptr<IoBackend> MakeIoBackend(unsigned node) override {
+      UNREFERENCED_PARAMETER(node);
+      return MakeThreadPoolIoBackend(GetCallbackEnviron());
+    }
+
+    unsigned GetWorkerCount() const override { return _worker_count; }
+  };
+
+  // Workers take tasks from a lock-free queue, and sleep on a completion port when there are none. Reads of files bound
+  // to the port complete through it, and submits only post to it when someone is asleep. Split by NUMA node, every
+  // node has all of these, and its workers are pinned to its processors.
+  class ThreadExecutor : public Executor {
+    // Completion key of packets that only wake a worker up. Reads complete with 0.
+    static constexpr ULONG_PTR k_wake_key = 1;
+
+    struct Task {
+      ExecutorFn* fn;
+      void* ctx;
+    };
+
+    struct Node {
+      moodycamel::ConcurrentQueue<Task> tasks;
+      HANDLE port{};
+      std::atomic<unsigned> sleeping{};
+      // Zero if not split by node
+      GROUP_AFFINITY affinity{};
+      DWORD numa_node{NUMA_NO_PREFERRED_NODE};
+      unsigned workers{};
+
+      ~Node() {
+        if (port)
+          CloseHandle(port);
+      }
+
+      void Submit(ExecutorFn* fn, void* ctx) {
+        if (!tasks.enqueue(Task{fn, ctx})) {
+          fn(ctx);
+          return;
+        }
+        // Pairs with the one in Run(), so that either we see the sleeper or it sees the task
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) != 0)
+          PostQueuedCompletionStatus(port, 0, k_wake_key, nullptr);
+      }
+
+      // Returns false if the timeout passed without anything coming in
+      bool DispatchCompletion(DWORD timeout);
+    };
+
+    class Work : public ExecutorWork {
+      Node* _node;
+      ExecutorFn* _fn;
+      void* _ctx;
+
+    public:
+      Work(Node* node, ExecutorFn* fn, void* ctx)
+          : _node(node)
+          , _fn(fn)
+          , _ctx(ctx) {}
+
+      void Submit() override { _node->Submit(_fn, _ctx); }
+    };
+
+    unsigned _worker_count;
+    // Logical processors of the first group to pin workers to in turn, if not split by node
+    DWORD_PTR _affinity;
+    bool _numa;
+    std::unique_ptr<Node[]> _nodes;
+    unsigned _node_count{};
+    // Destroyed first, as they use the nodes
+    std::vector<std::jthread> _threads;
+
+    // Nodes that have processors, in the system's order
+    unsigned FindNodes();
+
+    void Pin(const Node& node, unsigned index) const;
+
+    void Run(const std::stop_token& stop, unsigned index);
+
+  public:
+    ThreadExecutor(unsigned workers, DWORD_PTR affinity, bool numa)
+        : _worker_count(workers ? workers : std::thread::hardware_concurrency())
+        , _affinity(affinity)
+        , _numa(numa) {}
+
+    ~ThreadExecutor() override {
+      for (auto& thread : _threads)
+        thread.request_stop();
+      for (auto i = 0u; i < _node_count; ++i)
+        for (auto j = 0u; j < _nodes[i].workers; ++j)
+          PostQueuedCompletionStatus(_nodes[i].port, 0, k_wake_key, nullptr);
+      // Joins them
+      _threads.clear();
+    }
+
+    bool Initialize() {
+      _node_count = _numa ? FindNodes() : 0;
+      if (_node_count < 2) {
+        _node_count = 1;
+        _nodes = std::make_unique<Node[]>(1);
+      }
+
+      // Every node gets at least one worker, so that its files get done
+      _worker_count = std::max(_worker_count, _node_count);
+      for (auto i = 0u; i < _worker_count; ++i)
+        ++_nodes[i % _node_count].workers;
+
+      for (auto i = 0u; i < _node_count; ++i) {
+        auto& node = _nodes[i];
+        node.port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, node.workers);
+        if (!node.port)
+          return false;
+      }
+
+      _threads.reserve(_worker_count);
+      for (auto i = 0u; i < _worker_count; ++i)
+        _threads.emplace_back([this, i](const std::stop_token& stop) { Run(stop, i); });
+      return true;
+    }
+
+    std::unique_ptr<ExecutorWork> CreateWork(ExecutorFn* fn, void* ctx, unsigned node) override {
+      return std::make_unique<Work>(&_nodes[node % _node_count], fn, ctx);
+    }
+
+    void Submit(ExecutorFn* fn, void* ctx, unsigned node) override { _nodes[node % _node_count].Submit(fn, ctx); }
+
+    std::unique_ptr<IoBackend> MakeIoBackend(unsigned node) override {
+      return MakeCompletionPortIoBackend(_nodes[node % _node_count].port);
+    }
+
+    unsigned GetWorkerCount() const override { return _worker_count; }
+
+    unsigned GetNodeCount() const override { return _node_count; }
+
+    DWORD GetNumaNode(unsigned node) const override { return _nodes[node % _node_count].numa_node; }
+  };
+
+  bool ThreadExecutor::Node::DispatchCompletion(DWORD timeout) {
+    DWORD bytes_transferred{};
+    ULONG_PTR key{};
+    LPOVERLAPPED overlapped{};
+    const auto ret = GetQueuedCompletionStatus(port, &bytes_transferred, &key, &overlapped, timeout);
+    // Woken up or timed out. A failed read still comes with its request.
+    if (!overlapped)
+      return ret != FALSE;
+
+    const auto request = CONTAINING_RECORD(overlapped, IoRequest, overlapped);
+    request->file->Complete(request, ret ? ERROR_SUCCESS : GetLastError(), bytes_transferred);
+    return true;
+  }
+
+  unsigned ThreadExecutor::FindNodes() {
+    ULONG highest{};
+    if (!GetNumaHighestNodeNumber(&highest) || highest == 0)
+      return 0;
+
+    _nodes = std::make_unique<Node[]>(k_max_nodes);
+    auto count = 0u;
+    for (auto number = 0u; number <= highest && count < k_max_nodes; ++number) {
+      GROUP_AFFINITY affinity{};
+      // Nodes with only memory have no processors
+      if (!GetNumaNodeProcessorMaskEx((USHORT)number, &affinity) || affinity.Mask == 0)
+        continue;
+      _nodes[count].affinity = affinity;
+      _nodes[count].numa_node = number;
+      ++count;
+    }
+    return count;
+  }
+
+  void ThreadExecutor::Pin(const Node& node, unsigned index) const {
+    // Anywhere on the node, the scheduler knows better which of its processors is free
+    if (node.affinity.Mask != 0) {
+      SetThreadGroupAffinity(GetCurrentThread(), &node.affinity, nullptr);
+      return;
+    }
+
+    if (_affinity == 0)
+      return;
+
+    auto processors = 0u;
+    for (auto mask = _affinity; mask != 0; mask &= mask - 1)
+      ++processors;
+
+    // More workers than processors share them from the start again
+    auto mask = _affinity;
+    for (auto skip = index % processors; skip != 0; --skip)
+      mask &= mask - 1;
+    SetThreadAffinityMask(GetCurrentThread(), mask & (~mask + 1));
+  }
+
+  void ThreadExecutor::Run(const std::stop_token& stop, unsigned index) {
+    auto& node = _nodes[index % _node_count];
+    Pin(node, index);
+
+    while (!stop.stop_requested()) {
+      // Reads first, they keep the devices busy while we hash
+      if (node.DispatchCompletion(0))
+        continue;
+
+      Task task{};
+      if (node.tasks.try_dequeue(task)) {
+        task.fn(task.ctx);
+        continue;
+      }
+
+      node.sleeping.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      // A submit may have looked at the count right before we said we're going to sleep
+      if (node.tasks.try_dequeue(task)) {
+        node.sleeping.fetch_sub(1, std::memory_order_relaxed);
+        task.fn(task.ctx);
+        continue;
+      }
+
+      node.DispatchCompletion(INFINITE);
+      node.sleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+} // namespace
+
+std::unique_ptr<Executor> MakeExecutor(const Settings& settings, unsigned workers) {
+  const auto strict = workers != 0;
+  if (!strict)
+    workers = settings.worker_count;
+
+  if (settings.executor == ExecutorType_Threads) {
+    auto executor = std::make_unique<ThreadExecutor>(workers, (DWORD_PTR)settings.worker_affinity, settings.numa);
+    if (executor->Initialize())
+      return executor;
+    if (strict)
+      return nullptr;
+  } else {
+    auto executor = std::make_unique<ThreadPoolExecutor>();
+    if (executor->Initialize(workers))
+      return executor;
+    if (strict)
+      return nullptr;
+  }
+
+  // The process default pool always works
+  auto executor = std::make_unique<ThreadPoolExecutor>();
+  executor->Initialize(0);
+  return executor;
+}
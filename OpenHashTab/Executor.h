@@ -0,0 +1,74 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include "IoBackend.h"
+
+struct Settings;
+
+enum ExecutorType : DWORD {
+  // The process default pool, or a private one if the worker count was pinned
+  ExecutorType_ThreadPool,
+  // Threads of our own waiting on a completion port, which also delivers the reads of the thread pool IO backend. With
+  // settings.numa, every NUMA node with processors gets a port and workers of its own.
+  ExecutorType_Threads
+};
+
+// Called on a worker thread, with the ctx given when creating the work or submitting it
+using ExecutorFn = void(void* ctx);
+
+// Something to run on the executor over and over, like hashing a file's next block. Creating it up front means
+// submitting it never allocates or fails.
+class ExecutorWork {
+public:
+  virtual ~ExecutorWork() = default;
+
+  // Run the callback once more, even if it's already queued or running
+  virtual void Submit() = 0;
+};
+
+// Runs the engine's callbacks: hash rounds not on a HashScheduler, small files, and read completions.
+//
+// Workers may be split by NUMA node, in which case work and reads only ever run on the workers of the node they were
+// created for. Nodes are numbered from 0 to GetNodeCount(), which isn't necessarily the system's numbering.
+class Executor {
+public:
+  static constexpr unsigned k_max_nodes = 16;
+
+  virtual ~Executor() = default;
+
+  // Returns nullptr and sets last error on failure
+  virtual std::unique_ptr<ExecutorWork> CreateWork(ExecutorFn* fn, void* ctx, unsigned node) = 0;
+
+  // One-off, for rare paths. Runs the callback on this thread if it couldn't be queued.
+  virtual void Submit(ExecutorFn* fn, void* ctx, unsigned node) = 0;
+
+  // The IoBackendType_ThreadPool backend, completing reads on the node's workers
+  virtual std::unique_ptr<IoBackend> MakeIoBackend(unsigned node) = 0;
+
+  virtual unsigned GetWorkerCount() const = 0;
+
+  virtual unsigned GetNodeCount() const { return 1; }
+
+  // The system's number of the node for allocating memory on it, NUMA_NO_PREFERRED_NODE if not split
+  virtual DWORD GetNumaNode(unsigned node) const {
+    UNREFERENCED_PARAMETER(node);
+    return NUMA_NO_PREFERRED_NODE;
+  }
+};
+
+// `workers` overrides settings.worker_count if nonzero. Returns nullptr and sets last error if a private pool or
+// thread couldn't be created.
+std::unique_ptr<Executor> MakeExecutor(const Settings& settings, unsigned workers);
@@ -16,82 +16,78 @@
 #include "FileHashTask.h"
 
 #include "Coordinator.h"
+#include "Device.h"
 #include "Queues.h"
 #include "utl.h"
 
-std::atomic<intptr_t> FileHashTask::s_allocations_remaining = k_max_allocations;
+std::atomic<size_t> FileHashTask::s_next_device;
 
-uint8_t* FileHashTask::BlockTryAllocate() {
-  if (--s_allocations_remaining >= 0) {
-    const auto p = VirtualAlloc(
-      nullptr,
-      k_block_size,
-      MEM_RESERVE | MEM_COMMIT,
-      PAGE_READWRITE
-    );
-
-    if (p)
-      return static_cast<uint8_t*>(p);
+// Mapped views raise an in-page error instead of failing a read, for example when a network drive disconnects. This
+// can't live in a function that needs unwinding.
+static bool GuardedUpdate(HashBox& ctx, const uint8_t* data, size_t size) {
+  __try {
+    ctx.Update(data, size);
+  } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+    return false;
   }
+  return true;
+}
 
-  ++s_allocations_remaining;
-  return nullptr;
+// Holes all share the zero block, which some contexts can take without going over it
+static void UpdateBlock(HashBox& ctx, const uint8_t* data, size_t size) {
+  if (data == BlockPool::GetZeroBlock() && ctx.CanUpdateZeros())
+    ctx.UpdateZeros(size);
+  else
+    ctx.Update(data, size);
 }
 
-void FileHashTask::BlockReset(uint8_t* p) {
-  VirtualAlloc(
-    p,
-    k_block_size,
-    MEM_RESET,
-    PAGE_READWRITE
-  );
-  // We don't care about errors
+void FileHashTask::HashWorkCallback(void* ctx) {
+  static_cast<FileHashTask*>(ctx)->DoHashRound();
 }
 
-void FileHashTask::BlockFree(uint8_t* p) {
-  const auto ret = VirtualFree(p, 0, MEM_RELEASE);
-  (void)ret;
-  assert(ret);
-  ++s_allocations_remaining;
+void FileHashTask::ScheduledRoundCallback(void* ctx, size_t context, unsigned worker) {
+  const auto task = static_cast<FileHashTask*>(ctx);
+  // So the next block's round for this context comes back here
+  task->_context_workers[context] = worker;
+  task->HashRound(context);
 }
 
-VOID NTAPI FileHashTask::HashWorkCallback(
-  _Inout_ PTP_CALLBACK_INSTANCE instance,
-  _Inout_opt_ PVOID ctx,
-  _Inout_ PTP_WORK work
-) {
-  UNREFERENCED_PARAMETER(instance);
-  UNREFERENCED_PARAMETER(work);
-  static_cast<FileHashTask*>(ctx)->DoHashRound();
+void FileHashTask::ResumeCallback(void* ctx) {
+  static_cast<FileHashTask*>(ctx)->Resume();
 }
 
-VOID WINAPI FileHashTask::IoCallback(
-  _Inout_ PTP_CALLBACK_INSTANCE instance,
-  _Inout_opt_ PVOID ctx,
-  _Inout_opt_ PVOID overlapped,
-  _In_ ULONG result,
-  _In_ ULONG_PTR bytes_transferred,
-  _Inout_ PTP_IO io
-) {
-  UNREFERENCED_PARAMETER(instance);
-  UNREFERENCED_PARAMETER(overlapped);
-  UNREFERENCED_PARAMETER(io);
-  static_cast<FileHashTask*>(ctx)->OverlappedCompletionRoutine(result, bytes_transferred);
-}
-
-void FileHashTask::ProcessReadQueue(uint8_t* reuse_block) {
-  FileHashTask* waiting_for_read = nullptr;
-  do {
-    auto ret = g_read_queue.try_dequeue(waiting_for_read);
-    if (!ret)
-      break;
-    ret = waiting_for_read->ReadBlockAsync(reuse_block);
-    reuse_block = nullptr;
-    if (!ret)
-      break;
-  } while (true);
-  if (reuse_block)
-    BlockFree(reuse_block);
+void FileHashTask::IoCallback(void* ctx, IoRequest* request, DWORD error, size_t bytes_transferred) {
+  const auto slot = CONTAINING_RECORD(request, ReadSlot, request);
+  static_cast<FileHashTask*>(ctx)->ReadCompleted(*slot, error, bytes_transferred);
+}
+
+void FileHashTask::FailedReadCallback(void* ctx) {
+  const auto slot = static_cast<ReadSlot*>(ctx);
+  slot->request.file->Complete(&slot->request, slot->error, 0);
+}
+
+void FileHashTask::HoleReadCallback(void* ctx) {
+  const auto slot = static_cast<ReadSlot*>(ctx);
+  slot->request.file->Complete(&slot->request, ERROR_SUCCESS, slot->request.size);
+}
+
+void FileHashTask::AdmittedCallback(void* ctx) {
+  static_cast<FileHashTask*>(ctx)->Start();
+}
+
+void FileHashTask::ProcessReadQueue() {
+  // Grant blocks one device at a time, until every device either has nothing waiting or can't start more reads
+  const auto count = GetDeviceCount();
+  for (size_t idle = 0; idle < count;) {
+    auto& device = GetDevice(s_next_device++ % count);
+    FileHashTask* waiting_for_read = nullptr;
+    if (!device.read_queue.try_dequeue(waiting_for_read)) {
+      ++idle;
+      continue;
+    }
+    const auto started = waiting_for_read->ResumeFromQueue();
+    idle = started ? 0 : idle + 1;
+  }
 }
 
 FileHashTask::FileHashTask(Coordinator* prop_page, const std::wstring& path, ProcessedFileList::FileInfo file_info)
@@ -103,11 +99,16 @@ FileHashTask::FileHashTask(Coordinator* prop_page, const std::wstring& path, Pro
 
   for (auto i = 0u; i < LegacyHashAlgorithm::k_count; ++i) {
     _lparam_idx[i] = static_cast<uint8_t>(i);
-    if (_prop_page->settings.algorithms[i])
+    if (_prop_page->settings.algorithms[i]) {
       _hash_contexts[i] = LegacyHashAlgorithm::Algorithms()[i].MakeContext();
+      _enabled_contexts[_enabled_count++] = static_cast<uint8_t>(i);
+    }
   }
 
-  _handle = utl::OpenForRead(path, true);
+  const auto cache_hint = _prop_page->settings.cache_hint;
+  _drop_behind = cache_hint == CacheHint_DropBehind;
+
+  _handle = utl::OpenForRead(path, true, cache_hint != CacheHint_None);
 
   if (_handle == INVALID_HANDLE_VALUE) {
     _error = GetLastError();
@@ -123,28 +124,53 @@ FileHashTask::FileHashTask(Coordinator* prop_page, const std::wstring& path, Pro
   _file_size = static_cast<uint64_t>(fi.nFileSizeHigh) << 32 | fi.nFileSizeLow;
   _file_index = static_cast<uint64_t>(fi.nFileIndexHigh) << 32 | fi.nFileIndexLow;
 
-  // TODO: use this in queue so a lot of files from a slower device can't slow down another faster device
   _volume_serial = fi.dwVolumeSerialNumber;
+  _device = &GetDeviceInfo(_handle, _volume_serial);
 
-  _threadpool_hash_work = CreateThreadpoolWork(
-    HashWorkCallback,
-    this,
-    nullptr
-  );
+  _block_size = ChooseBlockSize();
+  _small = IsSmallFile();
+  _read_ahead = std::clamp<unsigned>(_prop_page->settings.read_ahead, 1, k_max_read_ahead);
+
+  // Small files are hashed in one go on the thread pool
+  if (!_small)
+    _scheduler = _prop_page->GetHashScheduler();
+  // Without any algorithm nobody would ever release the blocks
+  _broadcast = _scheduler && _scheduler->IsGrouped() && _enabled_count != 0;
+  for (auto& worker : _context_workers)
+    worker = HashScheduler::k_any_worker;
+
+  if (!_small && ShouldReadDirect())
+    ReopenDirect();
 
-  if (!_threadpool_hash_work) {
+  // Files are spread over the nodes by size, and stay on theirs from reading to hashing
+  auto& executor = _prop_page->GetExecutor();
+  _node = _prop_page->PickNode(_file_size);
+  _numa_node = executor.GetNumaNode(_node);
+
+  _hash_work = executor.CreateWork(_small ? ResumeCallback : HashWorkCallback, this, _node);
+
+  if (!_hash_work) {
     _error = GetLastError();
     return;
   }
 
-  _threadpool_io = CreateThreadpoolIo(
+  // Read synchronously, the handle doesn't need binding
+  if (_small)
+    return;
+
+  // Has to be asked before the handle is bound, as we wait for it here
+  const auto sparse = (fi.dwFileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+  if (sparse && _prop_page->settings.skip_holes && BlockPool::GetZeroBlock())
+    _sparse = utl::GetAllocatedRanges(_handle, _file_size, _data_ranges);
+
+  _io = _prop_page->GetIoBackend(_node).Open(
     _handle,
+    _volume_serial,
     IoCallback,
-    this,
-    nullptr
+    this
   );
 
-  if (!_threadpool_io) {
+  if (!_io) {
     _error = GetLastError();
     return;
   }
@@ -153,138 +179,852 @@ FileHashTask::FileHashTask(Coordinator* prop_page, const std::wstring& path, Pro
 FileHashTask::~FileHashTask() {
   assert(_block == nullptr);
 
+  UnmapFile();
+
+  // Unbind from the backend before the handle goes away
+  _io.reset();
   if (_handle != INVALID_HANDLE_VALUE)
     CloseHandle(_handle);
-  if (_threadpool_hash_work)
-    CloseThreadpoolWork(_threadpool_hash_work);
-  if (_threadpool_io)
-    CloseThreadpoolIo(_threadpool_io);
 }
 
 void FileHashTask::StartProcessing() {
   _prop_page->Reference();
-  ReadBlockAsync();
+  if (_error == ERROR_SUCCESS && !TryAdmit())
+    return;
+  Start();
 }
 
-bool FileHashTask::ReadBlockAsync(uint8_t* reuse_block) {
-  if (_error != ERROR_SUCCESS) {
-    if (reuse_block)
-      BlockFree(reuse_block);
-    Finish();
+void FileHashTask::AbortReads() {
+  // The backend may have reads that didn't reach the handle yet
+  if (_io)
+    _io->Cancel();
+  // Whatever is in flight on the handle, including the synchronous read of a small file
+  else if (_handle != INVALID_HANDLE_VALUE)
+    CancelIoEx(_handle, nullptr);
+}
+
+bool FileHashTask::TryAdmit() {
+  const auto max_files = _device->device_class == DeviceClass_Rotational
+                           ? (size_t)_prop_page->settings.rotational_files
+                           : 0;
+  if (max_files == 0)
+    return true;
+
+  std::lock_guard lock{_device->admission_mutex};
+  if (_device->active_files < max_files) {
+    ++_device->active_files;
+    _admitted = true;
     return true;
   }
 
-  // Set up OVERLAPPED fields for either reading or enqueueing for read
-  _overlapped.Internal = 0;     // reserved
-  _overlapped.InternalHigh = 0; // reserved
-  _overlapped.Offset = static_cast<DWORD>(_current_offset);
-  _overlapped.OffsetHigh = static_cast<DWORD>(_current_offset >> 32);
-  //_overlapped.hEvent = this; // for caller use
+  _device->pending_files.push_back(this);
+  return false;
+}
 
-  if (const auto block = reuse_block ? reuse_block : BlockTryAllocate()) {
-    const auto read_size = static_cast<DWORD>(GetCurrentBlockSize());
+void FileHashTask::LeaveDevice() {
+  FileHashTask* next = nullptr;
+  {
+    std::lock_guard lock{_device->admission_mutex};
+    _admitted = false;
+    if (_draining) {
+      // The next one already has our place
+      --_device->draining_files;
+    } else if (_device->pending_files.empty()) {
+      --_device->active_files;
+    } else {
+      // Our place goes straight to the next one, so active_files stays the same
+      next = _device->pending_files.front();
+      _device->pending_files.pop_front();
+      next->_admitted = true;
+    }
+  }
 
-    StartThreadpoolIo(_threadpool_io);
+  if (next)
+    next->_prop_page->GetExecutor().Submit(AdmittedCallback, next, next->_node);
+}
 
-    _block = block;
+void FileHashTask::LeaveEarly() {
+  FileHashTask* next = nullptr;
+  {
+    std::lock_guard lock{_device->admission_mutex};
+    if (!_admitted || _draining || _device->draining_files != 0 || _device->pending_files.empty())
+      return;
+    ++_device->draining_files;
+    _draining = true;
+    next = _device->pending_files.front();
+    _device->pending_files.pop_front();
+    next->_admitted = true;
+  }
 
-    const auto ret = ReadFile(
-      _handle,
-      block,
-      read_size,
-      nullptr,
-      &_overlapped
-    );
+  // Its first reads queue up behind our last ones, so the drive doesn't sit idle while we hash
+  next->_prop_page->GetExecutor().Submit(AdmittedCallback, next, next->_node);
+}
 
-    const auto error = GetLastError();
+size_t FileHashTask::ChooseBlockSize() const {
+  // Fixed size requested, round up to the nearest one we have
+  if (const auto fixed_size = (size_t)_prop_page->settings.block_size << 10) {
+    for (const auto size : BlockPool::k_block_sizes)
+      if (size >= fixed_size)
+        return size;
+    return std::end(BlockPool::k_block_sizes)[-1];
+  }
 
-    if (ret || error == ERROR_IO_PENDING) // succeeded
-      return true;
+  // Bigger reads only pay off when there's no seek penalty, elsewhere stay with what always worked
+  const auto max_size = _device->device_class == DeviceClass_SolidState
+                          ? std::end(BlockPool::k_block_sizes)[-1]
+                          : k_max_block_size_rotational;
+
+  // Smallest one that holds the whole file, or the largest allowed
+  for (const auto size : BlockPool::k_block_sizes)
+    if (size >= _file_size || size >= max_size)
+      return size;
+  return max_size;
+}
 
-    _block = nullptr;
+bool FileHashTask::IsSmallFile() const {
+  const auto& settings = _prop_page->settings;
+  if (settings.read_mode != ReadMode_Auto && settings.read_mode != ReadMode_Buffered)
+    return false;
+  // Read into a single block
+  const auto max_size = std::min<uint64_t>(
+    (uint64_t)settings.small_file_size << 10,
+    std::end(BlockPool::k_block_sizes)[-1]
+  );
+  return _file_size <= max_size;
+}
 
-    CancelThreadpoolIo(_threadpool_io);
+bool FileHashTask::ShouldMap() const {
+  // Mapping an empty file fails. Small files are cheaper to just read.
+  if (_file_size == 0 || _small)
+    return false;
 
-    // We failed to start the async operation, free block - cant give it back
-    BlockFree(block);
+  switch (_prop_page->settings.read_mode) {
+  case ReadMode_Mapped:
+    return true;
+  case ReadMode_Auto:
+    if (_sector_size)
+      return false;
+    // There's no way to ask whether a file is in the standby list, and a cold view faults in a page at a time where a
+    // read would have gone in one request, so only map by size if asked to. Prefetching makes it closer to a read.
+    return _file_size <= (uint64_t)_prop_page->settings.mapped_max_size << 20 && utl::CanPrefetchMemory();
+  case ReadMode_Buffered:
+  case ReadMode_Direct:
+  default:
+    return false;
+  }
+}
 
-    // If we got some unknown error don't reschedule, fail instead
-    if (error != ERROR_INVALID_USER_BUFFER && error != ERROR_NOT_ENOUGH_MEMORY) {
-      assert(_error);
-      _error = error;
-      Finish();
+bool FileHashTask::ShouldReadDirect() const {
+  const auto& settings = _prop_page->settings;
+  switch (settings.read_mode) {
+  case ReadMode_Direct:
+    return true;
+  case ReadMode_Auto:
+    if (_drop_behind)
       return true;
+    return settings.direct_min_size != 0 && _file_size >= (uint64_t)settings.direct_min_size << 20;
+  case ReadMode_Buffered:
+  case ReadMode_Mapped:
+  default:
+    return false;
+  }
+}
+
+void FileHashTask::ReopenDirect() {
+  const auto sector_size = utl::GetSectorSize(_handle);
+
+  // Blocks are page aligned and every read but the last starts at a multiple of the block size
+  if (sector_size == 0 || (sector_size & (sector_size - 1)) != 0 || sector_size > _block_size)
+    return;
+
+  const auto handle = ReOpenFile(
+    _handle,
+    GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+    FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING
+  );
+
+  if (handle == INVALID_HANDLE_VALUE)
+    return;
+
+  CloseHandle(_handle);
+  _handle = handle;
+  _sector_size = sector_size;
+}
+
+void FileHashTask::MapFile() {
+  // Explicit size, so that we fail instead of running off the view if the file shrank since we opened it
+  _mapping = CreateFileMappingW(
+    _handle,
+    nullptr,
+    PAGE_READONLY,
+    static_cast<DWORD>(_file_size >> 32),
+    static_cast<DWORD>(_file_size),
+    nullptr
+  );
+
+  if (!_mapping)
+    return;
+
+  _view = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+
+  if (!_view)
+    UnmapFile();
+  else
+    _broadcast = false; // A view is hashed a block at a time by all contexts
+}
+
+void FileHashTask::UnmapFile() {
+  if (_view)
+    UnmapViewOfFile(_view);
+  if (_mapping)
+    CloseHandle(_mapping);
+  _view = nullptr;
+  _mapping = nullptr;
+}
+
+bool FileHashTask::DeviceTryAcquire() {
+  // So that a slow device with a lot of files waiting can't hold all of the budget
+  const auto max_bytes = (intptr_t)(BlockPool::GetBudget() / 4);
+  if ((_device->bytes_in_flight += (intptr_t)_block_size) <= max_bytes)
+    return true;
+
+  _device->bytes_in_flight -= (intptr_t)_block_size;
+  return false;
+}
+
+void FileHashTask::DeviceRelease() {
+  _device->bytes_in_flight -= (intptr_t)_block_size;
+}
+
+void FileHashTask::ReleaseBlock(uint8_t* data, StageController::Stage stage) {
+  // Holes only borrowed the zero block
+  if (data != BlockPool::GetZeroBlock())
+    BlockPool::Free({data, _block_size, _numa_node});
+  DeviceRelease();
+  StageController::Move(stage, StageController::Stage_None);
+}
+
+void FileHashTask::Start() {
+  if (_error == ERROR_SUCCESS && _cancelled)
+    _error = ERROR_CANCELLED;
+
+  // Nothing to read, but the hashes of nothing are still hashes
+  if (_error != ERROR_SUCCESS || _file_size == 0) {
+    Finish();
+    return;
+  }
+
+  if (_small) {
+    HashSmallFile();
+    return;
+  }
+
+  if (ShouldMap())
+    MapFile();
+
+  if (_view)
+    HashMappedFile();
+  else
+    HashReadFile();
+}
+
+bool FileHashTask::TakeBudget() {
+  if (_small) {
+    // Out of the pool like any other read, so that it's within the budget and gets trimmed
+    _small_block = BlockPool::TryAllocate(SmallBlockSize(), _numa_node);
+    return _small_block.data != nullptr;
+  }
+
+  // A view doesn't need memory, just the budget
+  if (!DeviceTryAcquire())
+    return false;
+  if (BlockPool::TryReserve(_block_size))
+    return true;
+  DeviceRelease();
+  return false;
+}
+
+void FileHashTask::WaitInQueue() {
+  {
+    std::lock_guard lock{_read_mutex};
+    if (std::exchange(_queued, true))
+      return;
+  }
+  _device->read_queue.enqueue(this);
+}
+
+bool FileHashTask::ResumeFromQueue() {
+  if (_small || _view) {
+    // Waiting in Budget, which only lets us go without a budget once we're cancelled
+    const auto granted = !_cancelled && TakeBudget();
+    if (!granted && !_cancelled) {
+      _device->read_queue.enqueue(this);
+      return false;
     }
+    _granted = granted;
+    Resume();
+    return true;
+  }
+
+  auto resume = false;
+  auto issue = false;
+  {
+    std::lock_guard lock{_read_mutex};
+    _queued = false;
+    if (_stopping)
+      resume = !_running && IsDrained();
+    else if (_cancelled)
+      // Nothing is in flight for the head then, so nobody else would get us going again
+      resume = !_running && SlotFor(_current_offset).state == ReadSlot::State_Free;
+    else
+      issue = true;
+    if (resume)
+      _running = true;
+  }
+
+  if (resume) {
+    Resume();
+    return true;
   }
 
-  // If we just ran out of memory or outstanding async ios, requeue
-  g_read_queue.enqueue(this);
+  if (!issue || IssueReads())
+    return true;
+
+  // If we just ran out of memory, outstanding async ios, or our device has enough going on, requeue
+  WaitInQueue();
   return false;
 }
 
-void FileHashTask::OverlappedCompletionRoutine(ULONG error_code, ULONG_PTR bytes_transferred) {
-  UNREFERENCED_PARAMETER(bytes_transferred);
+bool FileHashTask::IssueReads() {
+  // Once a read is started, the file may be finished on another thread before we return. Tasks live as long as their
+  // coordinator, so keep that around.
+  const auto coordinator = _prop_page;
+  coordinator->Reference();
 
-  uint8_t* reuse_block = nullptr;
+  // Unbuffered reads don't go through the cache at all
+  utl::LowMemoryPriorityScope low_priority{_drop_behind && !_sector_size};
+
+  const auto can_issue = [this] {
+    return !_stopping && _read_offset < _file_size && SlotFor(_read_offset).state == ReadSlot::State_Free;
+  };
+
+  while (true) {
+    uint64_t next{};
+    {
+      std::lock_guard lock{_read_mutex};
+      if (!can_issue())
+        break;
+      next = _read_offset;
+    }
+
+    // Nothing to read there, all contexts get is zeros
+    const auto hole = _sparse && IsHole(next, std::min<uint64_t>(_file_size - next, _block_size));
+
+    // Enough was read that hashing hasn't gotten to yet
+    if (!StageController::TryStartRead())
+      break;
+
+    if (!DeviceTryAcquire()) {
+      StageController::Move(StageController::Stage_Reading, StageController::Stage_None);
+      break;
+    }
+
+    // Nobody ever writes to a hole's block, so they can all share the same zeros
+    const auto block = hole
+                         ? BlockPool::Block{const_cast<uint8_t*>(BlockPool::GetZeroBlock()), _block_size}
+                         : BlockPool::TryAllocate(_block_size, _numa_node);
+    if (!block.data) {
+      DeviceRelease();
+      StageController::Move(StageController::Stage_Reading, StageController::Stage_None);
+      break;
+    }
+
+    ReadSlot* slot = nullptr;
+    uint64_t offset{};
+    {
+      std::lock_guard lock{_read_mutex};
+      // Someone else might have issued this one since we checked
+      if (can_issue() && _read_offset == next) {
+        offset = _read_offset;
+        slot = &SlotFor(offset);
+        _read_offset = std::min<uint64_t>(offset + _block_size, _file_size);
+        ++_reads_in_flight;
+        slot->state = ReadSlot::State_Reading;
+      }
+    }
+
+    if (!slot) {
+      ReleaseBlock(block.data, StageController::Stage_Reading);
+      continue;
+    }
+
+    auto& request = slot->request;
+    request.buffer = block.data;
+    request.capacity = hole ? 0 : (DWORD)block.size;
+    request.offset = offset;
+    request.size = static_cast<DWORD>(std::min<uint64_t>(_file_size - offset, _block_size));
+
+    if (hole) {
+      // Completed like a read, but not from this thread, as that may finish the file under our caller
+      request.file = _io.get();
+      _prop_page->HoleSkipped(request.size);
+      _prop_page->GetExecutor().Submit(HoleReadCallback, slot, _node);
+      continue;
+    }
+
+    // Unbuffered reads must be whole sectors. The block always has room for the rounded up tail, and reading past
+    // the end of file just returns less.
+    if (_sector_size)
+      request.size = (request.size + _sector_size - 1) & ~(_sector_size - 1);
+
+    const auto error = _io->ReadAsync(&request);
+
+    if (error == ERROR_SUCCESS)
+      continue;
+
+    // If we just ran out of memory or outstanding async ios, undo and try again later. We can only do that if nobody
+    // issued a read after ours, and we aren't stopping, in which case the last read finishes the file.
+    auto undone = false;
+    if (error == ERROR_INVALID_USER_BUFFER || error == ERROR_NOT_ENOUGH_MEMORY) {
+      std::lock_guard lock{_read_mutex};
+      if (!_stopping && _read_offset == std::min<uint64_t>(offset + _block_size, _file_size)) {
+        _read_offset = offset;
+        --_reads_in_flight;
+        slot->state = ReadSlot::State_Free;
+        undone = true;
+      }
+    }
+
+    if (undone) {
+      ReleaseBlock(block.data, StageController::Stage_Reading);
+    } else {
+      // Report it like any other failed read, so that hashing fails the file once it gets here. Not from this thread
+      // though, as that may finish the file under our caller.
+      slot->error = error;
+      _prop_page->GetExecutor().Submit(FailedReadCallback, slot, _node);
+    }
+    break;
+  }
+
+  bool reading, all_started;
+  {
+    std::lock_guard lock{_read_mutex};
+    reading = _read_offset != _current_offset;
+    all_started = !_stopping && _read_offset == _file_size;
+  }
+
+  if (all_started && _device->device_class == DeviceClass_Rotational)
+    LeaveEarly();
+
+  coordinator->Dereference();
+  return reading;
+}
+
+bool FileHashTask::IsHole(uint64_t offset, uint64_t size) const {
+  // The first range that ends past the offset is the only one that may overlap
+  const auto it = std::upper_bound(
+    _data_ranges.begin(),
+    _data_ranges.end(),
+    offset,
+    [](uint64_t offset, const std::pair<uint64_t, uint64_t>& range) { return offset < range.first + range.second; }
+  );
+  return it == _data_ranges.end() || it->first >= offset + size;
+}
+
+void FileHashTask::ReadCompleted(ReadSlot& slot, DWORD error, size_t bytes_transferred) {
+  // The file shrank since we opened it
+  const auto expected = std::min<uint64_t>(_file_size - slot.request.offset, _block_size);
+  if (error == ERROR_SUCCESS && bytes_transferred < expected)
+    error = ERROR_HANDLE_EOF;
+
+  uint8_t contexts[LegacyHashAlgorithm::k_count];
+  auto count = 0u;
+  auto resume = false;
+  uint8_t* freed = nullptr;
+  {
+    std::lock_guard lock{_read_mutex};
+    --_reads_in_flight;
+    if (_stopping) {
+      freed = slot.request.buffer;
+      slot.state = ReadSlot::State_Free;
+      resume = !_running && IsDrained();
+    } else {
+      slot.error = error;
+      slot.state = ReadSlot::State_Ready;
+      // Contexts pick the block up as soon as they get to it, there's no waiting in line for a whole round
+      if (_broadcast && error == ERROR_SUCCESS) {
+        slot.consumers = _enabled_count;
+        for (auto i = 0u; i < _enabled_count; ++i) {
+          const auto context = _enabled_contexts[i];
+          if (!_context_busy[context] && _context_offsets[context] == slot.request.offset) {
+            _context_busy[context] = true;
+            ++_busy_contexts;
+            contexts[count++] = context;
+          }
+        }
+      }
+      // Blocks are hashed in order, later ones wait for it
+      resume = &slot == &SlotFor(_current_offset) && !_running;
+    }
+    if (resume)
+      _running = true;
+  }
+
+  // Every context walks a broadcast block on its own, it isn't waiting for anyone
+  if (freed)
+    ReleaseBlock(freed, StageController::Stage_Reading);
+  else
+    StageController::Move(
+      StageController::Stage_Reading,
+      _broadcast ? StageController::Stage_Hashing : StageController::Stage_Waiting
+    );
+
+  // Reads held back may go now that this one is done
+  const auto process_queue = freed || (_broadcast && StageController::IsThrottled());
+
+  // Before resuming, which may finish the file. Nobody else resumes it until it waits again, and it can't finish while
+  // a context is busy.
+  SubmitRounds(contexts, count);
+
+  if (resume)
+    Resume();
+
+  if (process_queue)
+    ProcessReadQueue();
+}
+
+void FileHashTask::SubmitRounds(const uint8_t* contexts, unsigned count) {
+  for (auto i = 0u; i < count; ++i)
+    _scheduler->Submit(ScheduledRoundCallback, this, contexts[i], _context_workers[contexts[i]]);
+}
+
+void FileHashTask::FinishedRound(size_t context) {
+  auto again = false;
+  auto resume = false;
+  {
+    std::lock_guard lock{_read_mutex};
+    const auto offset = _context_offsets[context];
+    const auto next = offset + std::min<uint64_t>(_file_size - offset, _block_size);
+    _context_offsets[context] = next;
+
+    // The slowest context is done with the block. That's always the one at the head, so it's released in order.
+    const auto consumed = --SlotFor(offset).consumers == 0;
+
+    // The slot may still hold an older block that the slower contexts are on. Rounds only pass through once we're
+    // cancelled, so keep going until we stop, for the blocks to get released in order.
+    const auto& next_slot = SlotFor(next);
+    if (!_stopping && next < _file_size && next_slot.state == ReadSlot::State_Ready && next_slot.request.offset == next
+        && next_slot.error == ERROR_SUCCESS) {
+      again = true;
+    } else {
+      _context_busy[context] = false;
+      --_busy_contexts;
+    }
+
+    if (!_running)
+      resume = _stopping ? IsDrained() : consumed && offset == _current_offset;
+    if (resume)
+      _running = true;
+  }
+
+  if (again)
+    _scheduler->Submit(ScheduledRoundCallback, this, context, _context_workers[context]);
+
+  if (resume)
+    Resume();
+}
+
+bool FileHashTask::Budget::await_ready() const noexcept {
+  const auto t = task;
+  t->_granted = !t->_cancelled && t->TakeBudget();
+  return t->_granted || t->_cancelled;
+}
+
+void FileHashTask::Budget::await_suspend(std::coroutine_handle<> handle) const noexcept {
+  const auto t = task;
+  // ResumeFromQueue() takes over
+  t->_continuation = handle;
+  t->_device->read_queue.enqueue(t);
+}
+
+void FileHashTask::OnWorker::await_suspend(std::coroutine_handle<> handle) const noexcept {
+  const auto t = task;
+  t->_continuation = handle;
+  t->_hash_work->Submit();
+}
+
+void FileHashTask::HashRounds::await_suspend(std::coroutine_handle<> handle) const noexcept {
+  const auto t = task;
+  t->_continuation = handle;
+
+  // The last round may resume us before the loop checks the count again
+  const auto count = t->_enabled_count;
+
+  t->_hash_start_counter.store(count, std::memory_order_relaxed);
+  t->_hash_finish_counter.store(count, std::memory_order_relaxed);
+
+  if (t->_scheduler) {
+    for (auto i = 0u; i < count; ++i) {
+      const auto context = t->_enabled_contexts[i];
+      t->_scheduler->Submit(ScheduledRoundCallback, t, context, t->_context_workers[context]);
+    }
+    return;
+  }
+
+  for (auto i = 0u; i < count; ++i)
+    t->_hash_work->Submit();
+}
+
+bool FileHashTask::HeadRead::await_suspend(std::coroutine_handle<> handle) const noexcept {
+  const auto t = task;
+  std::lock_guard lock{t->_read_mutex};
+  if (t->_cancelled || t->SlotFor(t->_current_offset).state == ReadSlot::State_Ready)
+    return false;
+  // ReadCompleted() takes over once it's in, or ResumeFromQueue() if we're cancelled while in line
+  t->_continuation = handle;
+  t->_running = false;
+  return true;
+}
+
+bool FileHashTask::HeadHashed::await_suspend(std::coroutine_handle<> handle) const noexcept {
+  const auto t = task;
+  std::lock_guard lock{t->_read_mutex};
+  if (t->SlotFor(t->_current_offset).consumers == 0)
+    return false;
+  // The slowest context takes over once it's done with it
+  t->_continuation = handle;
+  t->_running = false;
+  return true;
+}
+
+bool FileHashTask::ReadsDrained::await_suspend(std::coroutine_handle<> handle) const noexcept {
+  const auto t = task;
+  std::lock_guard lock{t->_read_mutex};
+  t->_stopping = true;
+  if (t->IsDrained())
+    return false;
+  // The last read to complete, context to finish or queue to let go of us takes over
+  t->_continuation = handle;
+  t->_running = false;
+  return true;
+}
+
+size_t FileHashTask::SmallBlockSize() const {
+  return *std::find_if(
+    std::begin(BlockPool::k_block_sizes),
+    std::end(BlockPool::k_block_sizes),
+    [this](size_t block_size) { return block_size >= _file_size; }
+  );
+}
+
+DetachedTask FileHashTask::HashSmallFile() {
+  // Without a block the file waits in the queue like any other blocked read, instead of going around through a worker
+  if (!co_await Budget{this}) {
+    _error = ERROR_CANCELLED;
+    Finish();
+    co_return;
+  }
+
+  co_await OnWorker{this};
+
+  const auto size = static_cast<DWORD>(_file_size);
+  const auto block = std::exchange(_small_block, {});
 
   if (_cancelled)
-    error_code = ERROR_CANCELLED;
+    _error = ERROR_CANCELLED;
 
-  if (error_code != ERROR_SUCCESS) {
-    _error = error_code;
-    reuse_block = _block;
-    _block = nullptr;
-    BlockReset(reuse_block);
+  if (_error == ERROR_SUCCESS) {
+    // The handle is overlapped, but not bound to anything, so we can just wait for it here
+    utl::LowMemoryPriorityScope low_priority{_drop_behind};
+    OVERLAPPED overlapped{};
+    DWORD read{};
+    auto ret = ReadFile(_handle, block.data, size, nullptr, &overlapped);
+    if (ret || GetLastError() == ERROR_IO_PENDING)
+      ret = GetOverlappedResult(_handle, &overlapped, &read, TRUE);
+
+    if (!ret)
+      _error = _cancelled ? ERROR_CANCELLED : GetLastError();
+    else if (read < size)
+      _error = ERROR_HANDLE_EOF; // The file shrank since we opened it
+  }
+
+  if (_error == ERROR_SUCCESS) {
+    for (auto i = 0u; i < _enabled_count; ++i)
+      _hash_contexts[_enabled_contexts[i]].Update(block.data, size);
+    _prop_page->FileProgressCallback(size);
+    _current_offset = size;
+  }
+
+  BlockPool::Free(block);
+  Finish();
+  ProcessReadQueue();
+}
+
+DetachedTask FileHashTask::HashMappedFile() {
+  // Kept from one block to the next
+  if (!co_await Budget{this}) {
+    _error = ERROR_CANCELLED;
     Finish();
-  } else {
-    AddToHashQueue();
+    co_return;
+  }
+
+  while (true) {
+    // Bring in this block and the next one with large reads, rather than faulting them in page by page
+    const auto size = std::min<uint64_t>(_file_size - _current_offset, 2 * _block_size);
+    {
+      utl::LowMemoryPriorityScope low_priority{_drop_behind};
+      utl::PrefetchMemory(_view + _current_offset, (size_t)size);
+    }
+
+    if (_current_offset + size == _file_size && _device->device_class == DeviceClass_Rotational)
+      LeaveEarly();
+
+    co_await HashRounds{this};
+
+    const auto block_size = GetCurrentBlockSize();
+    _prop_page->FileProgressCallback(block_size);
+    _current_offset += block_size;
+
+    if (_cancelled)
+      _error = ERROR_CANCELLED;
+    else if (_read_fault)
+      _error = ERROR_READ_FAULT;
+
+    if (_error != ERROR_SUCCESS || _current_offset >= _file_size)
+      break;
   }
 
-  ProcessReadQueue(reuse_block);
+  BlockPool::Unreserve(_block_size);
+  DeviceRelease();
+  Finish();
+  ProcessReadQueue();
 }
 
-void FileHashTask::AddToHashQueue() {
-  assert(_block);
+DetachedTask FileHashTask::HashReadFile() {
+  if (!IssueReads())
+    WaitInQueue();
+
+  while (true) {
+    co_await HeadRead{this};
+
+    // Possibly without a block, if we were cancelled while in line
+    if (_cancelled) {
+      _error = ERROR_CANCELLED;
+      break;
+    }
 
-  _hash_start_counter.store(LegacyHashAlgorithm::k_count, std::memory_order_relaxed);
-  _hash_finish_counter.store(LegacyHashAlgorithm::k_count, std::memory_order_relaxed);
+    const auto& slot = SlotFor(_current_offset);
+    if (slot.error != ERROR_SUCCESS) {
+      _error = slot.error;
+      break;
+    }
 
-  for (auto i = 0u; i < LegacyHashAlgorithm::k_count; ++i)
-    SubmitThreadpoolWork(_threadpool_hash_work);
+    if (_broadcast) {
+      co_await HeadHashed{this};
+    } else {
+      _block = slot.request.buffer;
+      StageController::Move(StageController::Stage_Waiting, StageController::Stage_Hashing);
+
+      // Reads held back may go now that this block left the queue
+      if (StageController::IsThrottled())
+        ProcessReadQueue();
+
+      co_await HashRounds{this};
+      _block = nullptr;
+    }
+
+    const auto block_size = GetCurrentBlockSize();
+    _prop_page->FileProgressCallback(block_size);
+
+    uint8_t* block = nullptr;
+    {
+      std::lock_guard lock{_read_mutex};
+      auto& head = SlotFor(_current_offset);
+      block = head.request.buffer;
+      head.state = ReadSlot::State_Free;
+      _current_offset += block_size;
+    }
+
+    // Most likely the next read we issue picks this up again from the thread cache
+    ReleaseBlock(block, StageController::Stage_Hashing);
+
+    if (_cancelled) {
+      _error = ERROR_CANCELLED;
+      break;
+    }
+
+    if (_current_offset >= _file_size) {
+      // Reads are in order, so there's none in flight past the end
+      Finish();
+      ProcessReadQueue();
+      co_return;
+    }
+
+    // Refill first, the next block may be in before we'd get to it
+    if (!IssueReads())
+      WaitInQueue();
+
+    ProcessReadQueue();
+  }
+
+  co_await ReadsDrained{this};
+
+  // Blocks read ahead are dropped unhashed. Ready ones are still waiting to be hashed, unless every context walks them
+  // on its own.
+  const auto stage = _broadcast ? StageController::Stage_Hashing : StageController::Stage_Waiting;
+  for (auto& slot : _slots)
+    if (slot.state == ReadSlot::State_Ready) {
+      slot.state = ReadSlot::State_Free;
+      ReleaseBlock(slot.request.buffer, stage);
+    }
+
+  Finish();
+  ProcessReadQueue();
 }
 
 void FileHashTask::DoHashRound() {
-  const auto ctx_index = --_hash_start_counter;
-  auto& ctx = _hash_contexts[ctx_index];
-  const auto block_size = GetCurrentBlockSize();
-  if (ctx.IsInitialized())
-    ctx.Update(_block, block_size);
-  const auto locks_on_this = --_hash_finish_counter;
-  if (locks_on_this == 0)
-    FinishedBlock();
+  HashRound(_enabled_contexts[--_hash_start_counter]);
 }
 
-void FileHashTask::FinishedBlock() {
+void FileHashTask::HashRound(size_t context) {
+  auto& ctx = _hash_contexts[context];
+
+  // Rounds still queued once we're cancelled only pass through, the digests are thrown away anyway
+  const auto cancelled = _cancelled.load(std::memory_order_relaxed);
+
+  if (_broadcast) {
+    // Only we move our cursor, and the block stays until every context is past it
+    const auto offset = _context_offsets[context];
+    if (!cancelled)
+      UpdateBlock(ctx, SlotFor(offset).request.buffer, (size_t)std::min<uint64_t>(_file_size - offset, _block_size));
+    FinishedRound(context);
+    return;
+  }
+
   const auto block_size = GetCurrentBlockSize();
-  _prop_page->FileProgressCallback(block_size);
-  _current_offset += block_size;
-  auto reuse_block = _block;
-  _block = nullptr;
-  BlockReset(reuse_block);
-
-  if (GetCurrentBlockSize() > 0 && !_cancelled) {
-    ReadBlockAsync(reuse_block);
-    reuse_block = nullptr;
+  if (cancelled) {
+    // Nothing to hash
+  } else if (!_view) {
+    UpdateBlock(ctx, _block, block_size);
   } else {
-    if (_cancelled)
-      _error = ERROR_CANCELLED;
-    Finish();
+    // Whatever the prefetch didn't bring in is faulted in here
+    utl::LowMemoryPriorityScope low_priority{_drop_behind};
+    if (!GuardedUpdate(ctx, GetCurrentBlockData(), block_size))
+      _read_fault = true;
   }
-
-  ProcessReadQueue(reuse_block);
+  // The last one picks the coroutine up again
+  if (--_hash_finish_counter == 0)
+    Resume();
 }
 
 void FileHashTask::Finish() {
+  // Hashing is done, don't hold on to the view until the window closes
+  UnmapFile();
+
+  if (_admitted)
+    LeaveDevice();
+
   if (!_error) {
     // If we expect a hash but none match, write no match to all algos
     _match_state = _file_info.expected_hashes.empty() ? MatchState_None : MatchState_Mismatch;
@@ -307,6 +1047,7 @@ void FileHashTask::Finish() {
     }
   }
 
+  _prop_page->NodeHashed(_node, _current_offset);
   _prop_page->FileCompletionCallback(this);
   _prop_page->Dereference();
 }
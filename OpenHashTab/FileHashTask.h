@@ -15,51 +15,143 @@
 //    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 
+#include "BlockPool.h"
+#include "Coroutine.h"
+#include "Executor.h"
+#include "HashScheduler.h"
+#include "IoBackend.h"
+#include "StageController.h"
 #include "path.h"
 
 class Coordinator;
+struct DeviceInfo;
+
+enum ReadMode : DWORD {
+  // Map files up to MappedMaxSize (none by default), read huge ones directly, and buffered read the rest
+  ReadMode_Auto,
+  ReadMode_Buffered,
+  ReadMode_Mapped,
+  // Bypass the file cache, for huge files read only once
+  ReadMode_Direct
+};
+
+// How much of what we read should stay in the file cache. Hashed files are usually read exactly once, so keeping them
+// around only pushes out what other programs are using.
+enum CacheHint : DWORD {
+  CacheHint_None,
+  // Tell the cache the file is read front to back, so it reads ahead further and unmaps what's behind sooner
+  CacheHint_Sequential,
+  // Also bypass the cache for files read in blocks with ReadMode_Auto, and make whatever still goes through it the
+  // first thing the standby list repurposes
+  CacheHint_DropBehind
+};
 
 class FileHashTask {
-  // Increasing this will make CPU use more efficient,
-  // but also increase memory usage
-  static constexpr size_t k_block_size = 2 << 20; // 2 MB
+  using Block = BlockPool::Block;
+
+  // Largest block for devices with a seek penalty, or ones we know nothing about. Larger blocks make CPU use more
+  // efficient, but also increase memory usage.
+  static constexpr size_t k_max_block_size_rotational = 2 << 20; // 2 MB
+
+  // Most blocks a file may have in flight or waiting to be hashed
+  static constexpr unsigned k_max_read_ahead = 8;
+
+  // Rotates the device ProcessReadQueue grants the next block to
+  static std::atomic<size_t> s_next_device;
+
+  static void HashWorkCallback(void* ctx);
+
+  static void ScheduledRoundCallback(void* ctx, size_t context, unsigned worker);
+
+  // Picks up the coroutine where it waits for a worker, see OnWorker
+  static void ResumeCallback(void* ctx);
 
-  // Increasing this will increase memory use and reduce
-  // possibility of a slower disk clogging up the queue
-  static constexpr intptr_t k_max_allocations = 512; // 1 GB
+  static void IoCallback(void* ctx, IoRequest* request, DWORD error, size_t bytes_transferred);
 
-  static std::atomic<intptr_t> s_allocations_remaining;
+  // Completes a read that failed to start, ctx is the ReadSlot
+  static void FailedReadCallback(void* ctx);
 
-  static uint8_t* BlockTryAllocate();
-  static void BlockReset(uint8_t* p);
-  static void BlockFree(uint8_t* p);
+  // Completes a read of a hole without reading anything, ctx is the ReadSlot
+  static void HoleReadCallback(void* ctx);
 
-  static VOID NTAPI HashWorkCallback(
-    _Inout_ PTP_CALLBACK_INSTANCE instance,
-    _Inout_opt_ PVOID ctx,
-    _Inout_ PTP_WORK work
-  );
+  // Starts a file that was just given its turn on the device
+  static void AdmittedCallback(void* ctx);
 
-  static VOID WINAPI IoCallback(
-    _Inout_ PTP_CALLBACK_INSTANCE instance,
-    _Inout_opt_ PVOID ctx,
-    _Inout_opt_ PVOID overlapped,
-    _In_ ULONG result,
-    _In_ ULONG_PTR bytes_transferred,
-    _Inout_ PTP_IO io
-  );
+  static void ProcessReadQueue();
 
-  static void ProcessReadQueue(uint8_t* reuse_block = nullptr);
+  // A block being read or waiting to be hashed. Which one is used for an offset is decided by SlotFor().
+  struct ReadSlot {
+    enum State : uint8_t {
+      State_Free,
+      State_Reading,
+      State_Ready
+    };
 
+    IoRequest request{};
+    // Also set if less was read than asked for
+    DWORD error{};
+    State state{};
+    // Broadcast only, contexts yet to hash this block
+    unsigned consumers{};
+  };
+
+  // The block being hashed, always _block_size large
   uint8_t* _block{nullptr};
 
-  PTP_WORK _threadpool_hash_work = nullptr;
+  // Small files only, the block the whole file is read into. Taken before going to a worker, see HashSmallFile().
+  BlockPool::Block _small_block{};
+
+  ReadSlot _slots[k_max_read_ahead]{};
+  unsigned _read_ahead{1};
+
+  // Guards the slots and the fields below
+  std::mutex _read_mutex;
+  // Next offset to read, slots from _current_offset up to this are in use
+  uint64_t _read_offset{};
+  unsigned _reads_in_flight{};
+  // The coroutine is running, or about to be resumed by whoever set this. Cleared by the awaitables that suspend it
+  // until a read or a context gets somewhere.
+  bool _running{true};
+  // Failed or cancelled, waiting for reads in flight before finishing
+  bool _stopping{};
+  // In our device's read queue, see WaitInQueue()
+  bool _queued{};
+
+  // Broadcast only: each context's next block and whether it has a round queued or running
+  uint64_t _context_offsets[LegacyHashAlgorithm::k_count]{};
+  bool _context_busy[LegacyHashAlgorithm::k_count]{};
+  unsigned _busy_contexts{};
+
+  // Where the coroutine is suspended, set by the awaitables
+  std::coroutine_handle<> _continuation{};
+
+  // Whether the read queue gave us our budget, see Budget
+  bool _granted{};
+
+  // Whole file view if the file is hashed through a mapping instead of reads. Only made once the file has its turn on
+  // the device, so that files waiting for one don't hold a mapping.
+  HANDLE _mapping{};
+  const uint8_t* _view{};
+  std::atomic<bool> _read_fault{};
 
-  PTP_IO _threadpool_io = nullptr;
+  std::unique_ptr<ExecutorWork> _hash_work;
+
+  // Runs the hash rounds instead of the thread pool if set
+  HashScheduler* _scheduler{};
+
+  std::unique_ptr<IoFile> _io;
+
+  // Offset and length of the ranges of a sparse file that hold data, only if _sparse
+  std::vector<std::pair<uint64_t, uint64_t>> _data_ranges;
 
   HashBox _hash_contexts[LegacyHashAlgorithm::k_count];
 
-  OVERLAPPED _overlapped{};
+  // Indices of the initialized contexts, so that a hash round only fans out to those
+  uint8_t _enabled_contexts[LegacyHashAlgorithm::k_count]{};
+  unsigned _enabled_count{};
+
+  // Scheduler worker that last ran each context
+  unsigned _context_workers[LegacyHashAlgorithm::k_count]{};
 
   using hash_results_t = std::array<std::vector<uint8_t>, LegacyHashAlgorithm::k_count>;
 
@@ -77,13 +169,41 @@ class FileHashTask {
   uint64_t _file_index;
   uint32_t _volume_serial;
 
+  size_t _block_size{k_max_block_size_rotational};
+
+  DeviceInfo* _device{};
+
+  // Executor node whose workers run our callbacks and complete our reads, and the system's number of it for blocks
+  unsigned _node{};
+  DWORD _numa_node{NUMA_NO_PREFERRED_NODE};
+
+  // Nonzero if the handle was opened unbuffered, reads must be multiples of this
+  DWORD _sector_size{};
+
   DWORD _error{ERROR_SUCCESS};
 
   std::atomic<unsigned> _hash_start_counter{0};
   std::atomic<unsigned> _hash_finish_counter{0};
 
   int _match_state{};
-  bool _cancelled{};
+  std::atomic<bool> _cancelled{};
+
+  // Counted in our device's active files, guarded by its admission mutex
+  bool _admitted{};
+  // Our place was already passed on, see LeaveEarly()
+  bool _draining{};
+
+  // Read and hashed in one go on a worker, without async io
+  bool _small{};
+
+  // Every context walks the ready blocks on its own, see HashSchedulerType_Broadcast
+  bool _broadcast{};
+
+  // CacheHint_DropBehind
+  bool _drop_behind{};
+
+  // We know where the holes are, blocks entirely in one are hashed as zeros instead of being read
+  bool _sparse{};
 
   uint8_t _lparam_idx[LegacyHashAlgorithm::k_count]{};
 
@@ -102,26 +222,151 @@ public:
   void StartProcessing();
 
 private:
-  // Enqueue the next block for reading
-  // Returns true if an async io was started, false if the file was enqueued
-  bool ReadBlockAsync(uint8_t* reuse_block = nullptr);
+  size_t ChooseBlockSize() const;
+
+  bool IsSmallFile() const;
+
+  // Smallest block the whole file fits in, for small files
+  size_t SmallBlockSize() const;
+
+  bool ShouldMap() const;
+
+  bool ShouldReadDirect() const;
 
-  void OverlappedCompletionRoutine(ULONG error_code, ULONG_PTR bytes_transferred);
+  // Swap the handle for an unbuffered one. On failure we just keep reading buffered.
+  void ReopenDirect();
 
-  void AddToHashQueue();
+  // On failure we just fall back to reading. Must happen before the first read is issued.
+  void MapFile();
+
+  void UnmapFile();
+
+  // Devices with a seek penalty only read a few files at once, the rest wait here for a turn. Returns false if we were
+  // put in line, in that case whoever makes room for us starts reading.
+  bool TryAdmit();
+
+  // Pass on our turn to the next file in line, if any. The next one starts on a worker, as starting it here could
+  // finish it right away and pass the turn on again, through as many files as finish without waiting.
+  void LeaveDevice();
+
+  // Once every read is started, let the next file in line open with its first blocks while we hash the rest. Only one
+  // file per device does this at a time, so that it doesn't cascade through the line.
+  void LeaveEarly();
+
+  // Take our block size from the device's share of the budget
+  bool DeviceTryAcquire();
+  void DeviceRelease();
+
+  // Give back a read block and its share of the budget, `stage` being the one it was in last
+  void ReleaseBlock(uint8_t* data, StageController::Stage stage);
+
+  ReadSlot& SlotFor(uint64_t offset) { return _slots[offset / _block_size % _read_ahead]; }
+
+  // No data anywhere in the range
+  bool IsHole(uint64_t offset, uint64_t size) const;
+
+  // Read ahead until the slots are full, the whole file is requested or we can't get more blocks
+  // Returns whether the block at _current_offset is being read or ready
+  bool IssueReads();
+
+  // Wait for the read queue to grant us more blocks, unless we're already in it
+  void WaitInQueue();
+
+  // Called by ProcessReadQueue() for whatever we were in the read queue for
+  // Returns false if we're still waiting, and went back in line
+  bool ResumeFromQueue();
+
+  // Take what a small or mapped file needs before it starts, all at once
+  bool TakeBudget();
+
+  void ReadCompleted(ReadSlot& slot, DWORD error, size_t bytes_transferred);
+
+  void SubmitRounds(const uint8_t* contexts, unsigned count);
+
+  // Broadcast only, one context is done with its block. The coroutine lets go of it once every context is.
+  void FinishedRound(size_t context);
+
+  // With _read_mutex held. Once stopping, the coroutine finishes when this is true.
+  bool IsDrained() const { return _reads_in_flight == 0 && _busy_contexts == 0 && !_queued; }
+
+  // Awaitables for the coroutines. Once they suspend, another thread may resume the coroutine before await_suspend()
+  // returns, so that must not touch the frame, and with it the awaitable, past that point.
+
+  // Until our device's budget has room for us. False if we were cancelled while in line.
+  struct Budget {
+    FileHashTask* task;
+    bool await_ready() const noexcept;
+    void await_suspend(std::coroutine_handle<> handle) const noexcept;
+    bool await_resume() const noexcept { return task->_granted; }
+  };
+
+  // Until a worker picks us up
+  struct OnWorker {
+    FileHashTask* task;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  // Until every context hashed the current block, resumes on the worker that finished last
+  struct HashRounds {
+    FileHashTask* task;
+    bool await_ready() const noexcept { return task->_enabled_count == 0; }
+    void await_suspend(std::coroutine_handle<> handle) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  // Until the block at _current_offset is read, or we are cancelled
+  struct HeadRead {
+    FileHashTask* task;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  // Broadcast only, until every context is past the block at _current_offset
+  struct HeadHashed {
+    FileHashTask* task;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  // Stops reading, until no read is in flight and no context is hashing a block anymore
+  struct ReadsDrained {
+    FileHashTask* task;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) const noexcept;
+    void await_resume() const noexcept {}
+  };
+
+  void Resume() { std::exchange(_continuation, {}).resume(); }
+
+  // Once the file has its turn on the device, hash it with the coroutine for how it's read
+  void Start();
+
+  // Each hashes the whole file and ends with Finish()
+  DetachedTask HashSmallFile();
+  // Prefetches a block ahead of hashing, which reads straight from the view
+  DetachedTask HashMappedFile();
+  // Hashes the blocks in order as they come in. Reads are started by whoever has room for them, as the device's share
+  // of the budget is shared by every file on it.
+  DetachedTask HashReadFile();
 
   void DoHashRound();
 
-  void FinishedBlock();
+  void HashRound(size_t context);
 
   // Do NOT use "this" after calling Finish(), as it might be deleted
   // This may be the last reference to Coordinator, which then deletes us in destructor.
   void Finish();
 
+  const uint8_t* GetCurrentBlockData() const { return _view ? _view + _current_offset : _block; }
+
   size_t GetCurrentBlockSize() const {
     auto size = _file_size - _current_offset;
-    if (size > k_block_size)
-      size = k_block_size;
+    if (size > _block_size)
+      size = _block_size;
     return (size_t)size;
   }
 
@@ -151,4 +396,7 @@ public:
   int GetMatchState() const { return _match_state; }
 
   void SetCancelled() { _cancelled = true; }
+
+  // Fail the reads in flight right away, once cancelled
+  void AbortReads();
 };
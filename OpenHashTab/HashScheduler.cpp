@@ -0,0 +1,311 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "HashScheduler.h"
+
+#include "Settings.h"
+
+HashScheduler::HashScheduler(unsigned workers)
+    : _workers(std::make_unique<Worker[]>(workers ? workers : 1))
+    , _worker_count(workers ? workers : 1) {
+  QueryPerformanceFrequency(&_frequency);
+  for (auto i = 0u; i < _worker_count; ++i)
+    _workers[i].group_size = _worker_count;
+}
+
+HashScheduler::HashScheduler(
+  const std::vector<unsigned>& group_sizes,
+  const unsigned (&context_groups)[LegacyHashAlgorithm::k_count]
+)
+    : _worker_count(0)
+    , _groups(std::make_unique<Group[]>(LegacyHashAlgorithm::k_count)) {
+  QueryPerformanceFrequency(&_frequency);
+  std::vector<unsigned> group_firsts;
+  for (const auto size : group_sizes) {
+    group_firsts.push_back(_worker_count);
+    _worker_count += size;
+  }
+  _workers = std::make_unique<Worker[]>(_worker_count);
+  for (auto i = 0u; i < group_sizes.size(); ++i)
+    for (auto j = 0u; j < group_sizes[i]; ++j) {
+      auto& worker = _workers[group_firsts[i] + j];
+      worker.group_first = group_firsts[i];
+      worker.group_size = group_sizes[i];
+    }
+  // Contexts sharing a group each take turns on its workers on their own
+  for (auto i = 0u; i < LegacyHashAlgorithm::k_count; ++i) {
+    if (context_groups[i] == k_no_group)
+      continue;
+    _groups[i].first = group_firsts[context_groups[i]];
+    _groups[i].size = group_sizes[context_groups[i]];
+  }
+}
+
+HashScheduler::~HashScheduler() {
+  _stop = true;
+  for (auto i = 0u; i < _worker_count; ++i)
+    if (_workers[i].wake_event)
+      SetEvent(_workers[i].wake_event);
+  for (auto i = 0u; i < _worker_count; ++i) {
+    auto& worker = _workers[i];
+    if (worker.thread.joinable())
+      worker.thread.join();
+    if (worker.wake_event)
+      CloseHandle(worker.wake_event);
+  }
+}
+
+bool HashScheduler::Initialize() {
+  for (auto i = 0u; i < _worker_count; ++i) {
+    _workers[i].wake_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!_workers[i].wake_event)
+      return false;
+  }
+  for (auto i = 0u; i < _worker_count; ++i)
+    _workers[i].thread = std::thread([this, i] { Run(i); });
+  return true;
+}
+
+bool HashScheduler::TryTake(unsigned index, Item& item, bool& stolen) {
+  // Newest first from our own, that's the most likely to still be in cache
+  {
+    auto& self = _workers[index];
+    std::lock_guard lock{self.mutex};
+    if (!self.items.empty()) {
+      item = self.items.back();
+      self.items.pop_back();
+      stolen = false;
+      return true;
+    }
+  }
+
+  // Oldest first from others, their owner gets to it last
+  const auto& self = _workers[index];
+  for (auto i = 1u; i < self.group_size; ++i) {
+    auto& victim = _workers[self.group_first + (index - self.group_first + i) % self.group_size];
+    std::lock_guard lock{victim.mutex};
+    if (!victim.items.empty()) {
+      item = victim.items.front();
+      victim.items.pop_front();
+      stolen = true;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void HashScheduler::Run(unsigned index) {
+  auto& self = _workers[index];
+  while (true) {
+    Item item{};
+    auto stolen = false;
+    if (!TryTake(index, item, stolen)) {
+      self.sleeping = true;
+      // A submit may have looked at us right before we said we're going to sleep
+      if (!TryTake(index, item, stolen)) {
+        if (_stop)
+          break;
+        WaitForSingleObject(self.wake_event, INFINITE);
+        self.sleeping = false;
+        continue;
+      }
+      self.sleeping = false;
+    }
+
+    LARGE_INTEGER begin{}, end{};
+    QueryPerformanceCounter(&begin);
+    item.fn(item.ctx, item.context, index);
+    QueryPerformanceCounter(&end);
+
+    self.busy_ticks.fetch_add(end.QuadPart - begin.QuadPart, std::memory_order_relaxed);
+    self.rounds.fetch_add(1, std::memory_order_relaxed);
+    if (stolen)
+      self.steals.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void HashScheduler::Submit(HashRoundFn* fn, void* ctx, size_t context, unsigned worker) {
+  if (_groups) {
+    auto& group = _groups[context];
+    assert(group.size != 0);
+    if (worker < group.first || worker >= group.first + group.size)
+      worker = group.first + group.next++ % group.size;
+  } else if (worker >= _worker_count) {
+    worker = _next_worker++ % _worker_count;
+  }
+
+  auto& target = _workers[worker];
+  {
+    std::lock_guard lock{target.mutex};
+    target.items.push_back({fn, ctx, context});
+  }
+
+  if (target.sleeping) {
+    SetEvent(target.wake_event);
+    return;
+  }
+
+  // The one we want is busy, if anyone who could take it is idle let them have a look
+  for (auto i = 1u; i < target.group_size; ++i) {
+    auto& other = _workers[target.group_first + (worker - target.group_first + i) % target.group_size];
+    if (other.sleeping) {
+      SetEvent(other.wake_event);
+      break;
+    }
+  }
+}
+
+std::vector<HashScheduler::WorkerStats> HashScheduler::GetStats() const {
+  std::vector<WorkerStats> stats;
+  for (auto i = 0u; i < _worker_count; ++i) {
+    const auto& worker = _workers[i];
+    stats.push_back({
+      worker.rounds.load(std::memory_order_relaxed),
+      worker.steals.load(std::memory_order_relaxed),
+      (double)worker.busy_ticks.load(std::memory_order_relaxed) / (double)_frequency.QuadPart,
+    });
+  }
+  return stats;
+}
+
+// Relative cost of each enabled algorithm, measured by hashing the same buffer with all of them
+static std::array<double, LegacyHashAlgorithm::k_count> MeasureAlgorithmCosts(const Settings& settings) {
+  static constexpr size_t k_test_size = 256 << 10;
+
+  std::vector<uint8_t> buffer(k_test_size);
+  for (auto i = 0u; i < buffer.size(); ++i)
+    buffer[i] = (uint8_t)(i * 2654435761u >> 24);
+
+  LARGE_INTEGER frequency{};
+  QueryPerformanceFrequency(&frequency);
+
+  std::array<double, LegacyHashAlgorithm::k_count> costs{};
+  for (auto i = 0u; i < LegacyHashAlgorithm::k_count; ++i) {
+    if (!settings.algorithms[i])
+      continue;
+    auto ctx = LegacyHashAlgorithm::Algorithms()[i].MakeContext();
+    LARGE_INTEGER begin{}, end{};
+    QueryPerformanceCounter(&begin);
+    ctx.Update(buffer.data(), buffer.size());
+    QueryPerformanceCounter(&end);
+    // Never zero, so that every enabled one gets a share
+    costs[i] = std::max<double>((double)(end.QuadPart - begin.QuadPart), 1.) / (double)frequency.QuadPart;
+  }
+  return costs;
+}
+
+// Groups for the enabled algorithms, sized by their share of the total cost. One that doesn't add up to a whole worker
+// is put together with the next cheaper ones until they do. If rounding still ends up over `workers`, the largest
+// groups give up a worker, and once all are down to one the two cheapest are merged.
+static void SplitWorkers(
+  const std::array<double, LegacyHashAlgorithm::k_count>& costs,
+  unsigned workers,
+  std::vector<unsigned>& group_sizes,
+  unsigned (&context_groups)[LegacyHashAlgorithm::k_count]
+) {
+  struct Group {
+    double cost;
+    unsigned size;
+    std::vector<unsigned> contexts;
+  };
+
+  std::vector<unsigned> order;
+  auto total = 0.;
+  for (auto i = 0u; i < LegacyHashAlgorithm::k_count; ++i)
+    if (costs[i] > 0) {
+      order.push_back(i);
+      total += costs[i];
+    }
+  std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return costs[a] > costs[b]; });
+
+  workers = std::max(workers, 1u);
+  const auto per_worker = total / workers;
+
+  std::vector<Group> groups;
+  Group shared{};
+  for (const auto context : order) {
+    if (costs[context] >= per_worker) {
+      groups.push_back({costs[context], std::max(1u, (unsigned)(costs[context] / per_worker + 0.5)), {context}});
+      continue;
+    }
+    shared.cost += costs[context];
+    shared.contexts.push_back(context);
+    if (shared.cost >= per_worker) {
+      shared.size = 1;
+      groups.push_back(std::exchange(shared, {}));
+    }
+  }
+  if (!shared.contexts.empty()) {
+    shared.size = 1;
+    groups.push_back(std::move(shared));
+  }
+
+  auto count = 0u;
+  for (const auto& group : groups)
+    count += group.size;
+  while (count > workers) {
+    const auto largest = std::max_element(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+      return a.size < b.size;
+    });
+    if (largest->size > 1) {
+      --largest->size;
+    } else {
+      // All down to one worker each
+      std::sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) { return a.cost > b.cost; });
+      auto& cheapest = groups.back();
+      auto& next = groups[groups.size() - 2];
+      next.cost += cheapest.cost;
+      next.contexts.insert(next.contexts.end(), cheapest.contexts.begin(), cheapest.contexts.end());
+      groups.pop_back();
+    }
+    --count;
+  }
+
+  std::fill(std::begin(context_groups), std::end(context_groups), HashScheduler::k_no_group);
+  for (auto i = 0u; i < groups.size(); ++i) {
+    group_sizes.push_back(groups[i].size);
+    for (const auto context : groups[i].contexts)
+      context_groups[context] = i;
+  }
+}
+
+std::unique_ptr<HashScheduler> MakeHashScheduler(const Settings& settings, unsigned workers) {
+  std::unique_ptr<HashScheduler> scheduler;
+  switch (settings.hash_scheduler) {
+  case HashSchedulerType_WorkStealing:
+    scheduler = std::make_unique<HashScheduler>(workers);
+    break;
+  case HashSchedulerType_Broadcast: {
+    const auto costs = MeasureAlgorithmCosts(settings);
+    auto total = 0.;
+    for (const auto cost : costs)
+      total += cost;
+    if (total == 0)
+      return nullptr;
+    std::vector<unsigned> group_sizes;
+    unsigned context_groups[LegacyHashAlgorithm::k_count]{};
+    SplitWorkers(costs, workers, group_sizes, context_groups);
+    scheduler = std::make_unique<HashScheduler>(group_sizes, context_groups);
+    break;
+  }
+  case HashSchedulerType_ThreadPool:
+  default:
+    return nullptr;
+  }
+  if (!scheduler->Initialize())
+    return nullptr;
+  return scheduler;
+}
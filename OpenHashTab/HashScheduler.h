@@ -0,0 +1,124 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <Hasher.h>
+
+struct Settings;
+
+enum HashSchedulerType : DWORD {
+  HashSchedulerType_ThreadPool,
+  HashSchedulerType_WorkStealing,
+  // Every algorithm has threads of its own, and each walks the blocks of a file at its own pace instead of all of them
+  // finishing one block before the next is started
+  HashSchedulerType_Broadcast
+};
+
+// Called on a worker thread, with the ctx and context given to Submit and the index of the worker running it
+using HashRoundFn = void(void* ctx, size_t context, unsigned worker);
+
+// Runs hash rounds on threads of its own instead of the thread pool. Each worker has its own queue, and a round is
+// queued to the worker asked for, which should be the one that ran the same hash context last time, so that the
+// context stays in that core's cache. Workers only take rounds from others' queues when their own is empty.
+//
+// Workers may also be split into groups, one per context, in which case rounds only ever go to and get taken by
+// workers of their context's group.
+class HashScheduler {
+public:
+  // Submit to whichever worker is next in turn
+  static constexpr unsigned k_any_worker = ~0u;
+
+  // Group of a context that is never submitted
+  static constexpr unsigned k_no_group = ~0u;
+
+  struct WorkerStats {
+    uint64_t rounds;
+    // Rounds taken from another worker's queue
+    uint64_t steals;
+    // Time spent running rounds
+    double busy_seconds;
+  };
+
+private:
+  struct Item {
+    HashRoundFn* fn;
+    void* ctx;
+    size_t context;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Item> items;
+
+    HANDLE wake_event{};
+    std::atomic<bool> sleeping{};
+
+    // Workers this one takes rounds from when idle, including itself
+    unsigned group_first{};
+    unsigned group_size{};
+
+    std::atomic<uint64_t> rounds{};
+    std::atomic<uint64_t> steals{};
+    std::atomic<uint64_t> busy_ticks{};
+
+    std::thread thread;
+  };
+
+  struct Group {
+    unsigned first;
+    unsigned size;
+    std::atomic<unsigned> next;
+  };
+
+  std::unique_ptr<Worker[]> _workers;
+  unsigned _worker_count;
+  std::atomic<unsigned> _next_worker{};
+  // Empty if any worker runs any context
+  std::unique_ptr<Group[]> _groups;
+  std::atomic<bool> _stop{};
+  LARGE_INTEGER _frequency{};
+
+  bool TryTake(unsigned index, Item& item, bool& stolen);
+
+  void Run(unsigned index);
+
+public:
+  explicit HashScheduler(unsigned workers);
+  // Workers are split into groups of the given sizes, and every context only runs on the workers of the group given for
+  // it. Contexts may share a group, those with k_no_group must not be submitted.
+  HashScheduler(const std::vector<unsigned>& group_sizes, const unsigned (&context_groups)[LegacyHashAlgorithm::k_count]);
+  ~HashScheduler();
+
+  HashScheduler(const HashScheduler&) = delete;
+  HashScheduler(HashScheduler&&) = delete;
+  HashScheduler& operator=(const HashScheduler&) = delete;
+  HashScheduler& operator=(HashScheduler&&) = delete;
+
+  bool Initialize();
+
+  unsigned GetWorkerCount() const { return _worker_count; }
+
+  bool IsGrouped() const { return _groups != nullptr; }
+
+  // Queue a round on the given worker, or on the next one in turn if out of range or not in the context's group
+  void Submit(HashRoundFn* fn, void* ctx, size_t context, unsigned worker);
+
+  std::vector<WorkerStats> GetStats() const;
+};
+
+// Returns nullptr if the thread pool should be used, either because it was asked for or the scheduler failed to start.
+// For HashSchedulerType_Broadcast, the workers are split between the enabled algorithms by how long each takes to
+// hash a test buffer. Algorithms too cheap for a worker of their own share one, and there are never more than `workers`.
+std::unique_ptr<HashScheduler> MakeHashScheduler(const Settings& settings, unsigned workers);
@@ -0,0 +1,145 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#define HEADLESS_API __declspec(dllexport)
+#include "Headless.h"
+
+#include "BlockPool.h"
+#include "Coordinator.h"
+#include "FileHashTask.h"
+#include "StageController.h"
+
+extern "C" HEADLESS_API uint32_t __stdcall HeadlessHashW(const HeadlessJob* job, HeadlessResult* result) {
+  *result = {};
+
+  const auto coordinator = std::make_unique<HeadlessCoordinator>(
+    std::list<std::wstring>{job->files, job->files + job->file_count}
+  );
+
+  auto& settings = coordinator->settings;
+
+  // Don't let whatever the user has set up in the registry affect what we hash or how. Every engine setting is either
+  // taken from the job or pinned to its default here.
+  settings.look_for_sumfiles.SetNoSave(false);
+  settings.hash_sumfile_too.SetNoSave(false);
+  settings.sumfile_algorithm_only.SetNoSave(true);
+  settings.io_backend.SetNoSave(job->io_backend);
+  settings.io_queue_depth.SetNoSave(job->io_queue_depth);
+  settings.read_mode.SetNoSave(job->read_mode);
+  settings.mapped_max_size.SetNoSave(job->mapped_max_size);
+  settings.direct_min_size.SetNoSave(job->direct_min_size);
+  settings.block_size.SetNoSave(job->block_size);
+  settings.rotational_files.SetNoSave(job->rotational_files);
+  settings.small_file_size.SetNoSave(job->small_file_size);
+  settings.buffer_memory.SetNoSave(job->buffer_memory);
+  settings.read_ahead.SetNoSave(job->read_ahead);
+  settings.cache_hint.SetNoSave(job->cache_hint);
+  settings.start_order.SetNoSave(job->start_order);
+  settings.hash_scheduler.SetNoSave(job->hash_scheduler);
+  settings.stage_depth.SetNoSave(job->stage_depth);
+  settings.executor.SetNoSave(job->executor);
+  settings.worker_count.SetNoSave(0);
+  settings.worker_affinity.SetNoSave(job->worker_affinity);
+  settings.numa.SetNoSave(job->numa != 0);
+  settings.large_pages.SetNoSave(job->large_pages != 0);
+  settings.skip_holes.SetNoSave(job->skip_holes != 0);
+  settings.progress_interval.SetNoSave(100);
+  for (auto& algorithm : settings.algorithms)
+    algorithm.SetNoSave(false);
+  for (auto i = 0u; i < job->algorithm_count; ++i) {
+    const auto idx = LegacyHashAlgorithm::IdxByName(job->algorithms[i]);
+    if (idx < 0)
+      return ERROR_INVALID_PARAMETER;
+    settings.algorithms[idx].SetNoSave(true);
+  }
+
+  if (job->workers && !coordinator->SetWorkerCount(job->workers))
+    return GetLastError();
+
+  coordinator->AddFiles();
+
+  const auto stats_begin = BlockPool::GetStats();
+  StageController::StartStats();
+
+  LARGE_INTEGER frequency{}, begin{}, end{};
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&begin);
+
+  coordinator->ProcessFiles();
+
+  if (job->cancel_after_ms != 0 && !coordinator->WaitForFiles(job->cancel_after_ms)) {
+    LARGE_INTEGER cancel_begin{}, cancel_end{};
+    QueryPerformanceCounter(&cancel_begin);
+    coordinator->Cancel();
+    QueryPerformanceCounter(&cancel_end);
+    result->cancel_seconds = (double)(cancel_end.QuadPart - cancel_begin.QuadPart) / (double)frequency.QuadPart;
+  }
+
+  coordinator->WaitForFiles();
+
+  QueryPerformanceCounter(&end);
+
+  const auto stats_end = BlockPool::GetStats();
+  result->block_hits = stats_end.hits - stats_begin.hits;
+  result->block_misses = stats_end.misses - stats_begin.misses;
+  result->block_waits = stats_end.waits - stats_begin.waits;
+  result->block_large_pages = stats_end.large_pages - stats_begin.large_pages;
+
+  const auto stages = StageController::StopStats();
+  result->max_reads_in_flight = stages.max_depth[StageController::Stage_Reading];
+  result->max_blocks_waiting = stages.max_depth[StageController::Stage_Waiting];
+  result->reads_throttled = stages.throttled;
+  result->min_stage_target = stages.min_target;
+  result->max_stage_target = stages.max_target;
+  result->read_stall_seconds = stages.read_stall_seconds;
+  result->hash_stall_seconds = stages.hash_stall_seconds;
+
+  result->seconds = (double)(end.QuadPart - begin.QuadPart) / (double)frequency.QuadPart;
+
+  if (const auto scheduler = coordinator->GetHashScheduler()) {
+    const auto stats = scheduler->GetStats();
+    result->hash_workers = (uint32_t)stats.size();
+    for (auto i = 0u; i < stats.size(); ++i) {
+      result->hash_steals += stats[i].steals;
+      if (i < HeadlessResult::k_max_workers && result->seconds > 0)
+        result->worker_utilization[i] = stats[i].busy_seconds / result->seconds;
+    }
+  }
+
+  static_assert(HeadlessResult::k_max_nodes == Executor::k_max_nodes, "Node limits differ");
+  result->hole_bytes = coordinator->GetHoleBytes();
+
+  result->nodes = coordinator->GetExecutor().GetNodeCount();
+  for (auto i = 0u; i < result->nodes; ++i)
+    result->node_bytes[i] = coordinator->GetNodeHashed(i);
+
+  for (const auto& file : coordinator->GetFiles()) {
+    ++result->files;
+    if (file->GetError() == ERROR_SUCCESS)
+      result->bytes += file->GetSize();
+    else
+      ++result->errors;
+  }
+
+  return ERROR_SUCCESS;
+}
+
+extern "C" HEADLESS_API void* __stdcall HeadlessAllocateLargePages(size_t size) {
+  const auto large_page_size = BlockPool::GetLargePageSize();
+  if (large_page_size == 0 || size % large_page_size != 0)
+    return nullptr;
+
+  return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
@@ -0,0 +1,146 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Entry point for driving the hashing engine without any UI, used by the benchmark. This is not a stable interface,
+// both sides are expected to be built from the same tree.
+
+#ifndef HEADLESS_API
+#define HEADLESS_API __declspec(dllimport)
+#endif
+
+struct HeadlessJob {
+  const wchar_t* const* files{};
+  size_t file_count{};
+
+  // Algorithm names as in LegacyHashAlgorithm::GetName()
+  const char* const* algorithms{};
+  size_t algorithm_count{};
+
+  // Executor threads, 0 uses the process default thread pool or one thread per logical processor
+  uint32_t workers{};
+
+  // See ExecutorType
+  uint32_t executor{};
+
+  // Logical processors to pin the threads executor's workers to in turn, 0 none
+  uint32_t worker_affinity{};
+
+  // Nonzero splits the threads executor's workers, the files and their blocks by NUMA node
+  uint32_t numa{};
+
+  // Nonzero backs blocks with large pages, if the account may lock pages in memory
+  uint32_t large_pages{};
+
+  // See IoBackendType
+  uint32_t io_backend{};
+
+  // Most reads in flight, I/O ring only
+  uint32_t io_queue_depth{32};
+
+  // See ReadMode
+  uint32_t read_mode{};
+
+  // MB, largest file ReadMode_Auto maps, 0 none
+  uint32_t mapped_max_size{};
+
+  // MB, smallest file ReadMode_Auto reads unbuffered, 0 never
+  uint32_t direct_min_size{};
+
+  // KB, 0 picks per file
+  uint32_t block_size{};
+
+  // KB, files up to this are read inline, 0 never
+  uint32_t small_file_size{64};
+
+  // Blocks per file in flight or waiting to be hashed
+  uint32_t read_ahead{2};
+
+  // Files read at once from a drive with a seek penalty, 0 no limit
+  uint32_t rotational_files{1};
+
+  // MB, most memory used for read buffers, 0 no limit
+  uint32_t buffer_memory{};
+
+  // See CacheHint
+  uint32_t cache_hint{1};
+
+  // See StartOrder
+  uint32_t start_order{};
+
+  // See HashSchedulerType
+  uint32_t hash_scheduler{};
+
+  // Blocks reading or waiting to be hashed per hash worker, 0 no limit
+  uint32_t stage_depth{4};
+
+  // Nonzero hashes holes of sparse files without reading them
+  uint32_t skip_holes{1};
+
+  // Nonzero cancels the job this many ms after starting, if it's still running. See HeadlessResult::cancel_seconds.
+  uint32_t cancel_after_ms{};
+};
+
+struct HeadlessResult {
+  uint64_t files{};
+  uint64_t errors{};
+  uint64_t bytes{};
+
+  // Time between starting the first file and finishing the last one
+  double seconds{};
+
+  // Time between cancelling and the last file finishing, if the job was cancelled
+  double cancel_seconds{};
+
+  // Read buffer pool counters during the job, see BlockPool::Stats
+  uint64_t block_hits{};
+  uint64_t block_misses{};
+  uint64_t block_waits{};
+  uint64_t block_large_pages{};
+
+  // Bytes of sparse file holes hashed without being read
+  uint64_t hole_bytes{};
+
+  // Read and hash stage counters during the job, see StageController::Stats
+  uint64_t max_reads_in_flight{};
+  uint64_t max_blocks_waiting{};
+  uint64_t reads_throttled{};
+  uint64_t min_stage_target{};
+  uint64_t max_stage_target{};
+  double read_stall_seconds{};
+  double hash_stall_seconds{};
+
+  // Work stealing scheduler counters, see HashScheduler::WorkerStats. All zero with the thread pool.
+  static constexpr size_t k_max_workers = 64;
+  uint32_t hash_workers{};
+  uint64_t hash_steals{};
+  // Share of the time each worker spent hashing, only the first k_max_workers
+  double worker_utilization[k_max_workers]{};
+
+  // Bytes hashed by the workers of each executor node, see Executor::GetNodeCount()
+  static constexpr size_t k_max_nodes = 16;
+  uint32_t nodes{};
+  uint64_t node_bytes[k_max_nodes]{};
+};
+
+// Returns a Win32 error code
+extern "C" HEADLESS_API uint32_t __stdcall HeadlessHashW(const HeadlessJob* job, HeadlessResult* result);
+
+// Committed memory backed by large pages, with the engine's own privilege handling, so that benchmarks measure what
+// read blocks get. Size must be a multiple of the large page size. Free with VirtualFree, nullptr if not allowed.
+extern "C" HEADLESS_API void* __stdcall HeadlessAllocateLargePages(size_t size);
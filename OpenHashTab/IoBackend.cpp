@@ -0,0 +1,149 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "IoBackend.h"
+
+#include "Executor.h"
+
+namespace {
+  // Overlapped read of a handle whose completions are queued somewhere, returns ERROR_SUCCESS if one will be
+  DWORD StartRead(HANDLE handle, IoRequest* request) {
+    auto& overlapped = request->overlapped;
+    overlapped.Internal = 0;     // reserved
+    overlapped.InternalHigh = 0; // reserved
+    overlapped.Offset = static_cast<DWORD>(request->offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(request->offset >> 32);
+
+    const auto ret = ReadFile(
+      handle,
+      request->buffer,
+      request->size,
+      nullptr,
+      &overlapped
+    );
+
+    const auto error = GetLastError();
+
+    if (ret || error == ERROR_IO_PENDING) // succeeded
+      return ERROR_SUCCESS;
+
+    return error;
+  }
+
+  class ThreadPoolIoFile : public IoFile {
+    PTP_IO _threadpool_io{};
+
+    static VOID WINAPI IoCallback(
+      _Inout_ PTP_CALLBACK_INSTANCE instance,
+      _Inout_opt_ PVOID ctx,
+      _Inout_opt_ PVOID overlapped,
+      _In_ ULONG result,
+      _In_ ULONG_PTR bytes_transferred,
+      _Inout_ PTP_IO io
+    ) {
+      UNREFERENCED_PARAMETER(instance);
+      UNREFERENCED_PARAMETER(io);
+      const auto request = CONTAINING_RECORD(static_cast<LPOVERLAPPED>(overlapped), IoRequest, overlapped);
+      static_cast<ThreadPoolIoFile*>(ctx)->Complete(request, result, bytes_transferred);
+    }
+
+  public:
+    using IoFile::IoFile;
+
+    ~ThreadPoolIoFile() override {
+      if (_threadpool_io)
+        CloseThreadpoolIo(_threadpool_io);
+    }
+
+    bool Bind(PTP_CALLBACK_ENVIRON environ) {
+      _threadpool_io = CreateThreadpoolIo(
+        _handle,
+        IoCallback,
+        this,
+        environ
+      );
+      return _threadpool_io != nullptr;
+    }
+
+    DWORD ReadAsync(IoRequest* request) override {
+      request->file = this;
+
+      StartThreadpoolIo(_threadpool_io);
+
+      const auto error = StartRead(_handle, request);
+      if (error != ERROR_SUCCESS)
+        CancelThreadpoolIo(_threadpool_io);
+      return error;
+    }
+  };
+
+  class ThreadPoolIoBackend : public IoBackend {
+    PTP_CALLBACK_ENVIRON _environ;
+
+  public:
+    explicit ThreadPoolIoBackend(PTP_CALLBACK_ENVIRON environ)
+        : _environ(environ) {}
+
+    std::unique_ptr<IoFile> Open(HANDLE handle, DWORD volume_serial, IoCallbackFn* callback, void* ctx) override {
+      auto file = std::make_unique<ThreadPoolIoFile>(handle, volume_serial, callback, ctx);
+      if (!file->Bind(_environ))
+        return nullptr;
+      return file;
+    }
+  };
+
+  class CompletionPortIoFile : public IoFile {
+  public:
+    using IoFile::IoFile;
+
+    // A handle stays bound to the port until it's closed, there's nothing to undo here
+    bool Bind(HANDLE port) { return CreateIoCompletionPort(_handle, port, 0, 0) != nullptr; }
+
+    DWORD ReadAsync(IoRequest* request) override {
+      request->file = this;
+      return StartRead(_handle, request);
+    }
+  };
+
+  class CompletionPortIoBackend : public IoBackend {
+    HANDLE _port;
+
+  public:
+    explicit CompletionPortIoBackend(HANDLE port)
+        : _port(port) {}
+
+    std::unique_ptr<IoFile> Open(HANDLE handle, DWORD volume_serial, IoCallbackFn* callback, void* ctx) override {
+      auto file = std::make_unique<CompletionPortIoFile>(handle, volume_serial, callback, ctx);
+      if (!file->Bind(_port))
+        return nullptr;
+      return file;
+    }
+  };
+} // namespace
+
+std::unique_ptr<IoBackend> MakeIoBackend(DWORD type, Executor& executor, unsigned node, DWORD queue_depth) {
+  if (type == IoBackendType_IoRing)
+    if (auto backend = MakeIoRingBackend(queue_depth, executor, node))
+      return backend;
+  return executor.MakeIoBackend(node);
+}
+
+std::unique_ptr<IoBackend> MakeThreadPoolIoBackend(PTP_CALLBACK_ENVIRON environ) {
+  return std::make_unique<ThreadPoolIoBackend>(environ);
+}
+
+std::unique_ptr<IoBackend> MakeCompletionPortIoBackend(HANDLE port) {
+  return std::make_unique<CompletionPortIoBackend>(port);
+}
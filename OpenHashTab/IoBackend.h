@@ -0,0 +1,98 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+class Executor;
+class IoFile;
+
+struct IoRequest {
+  // Only used by the thread pool and completion port backends
+  OVERLAPPED overlapped{};
+
+  IoFile* file{};
+  uint8_t* buffer{};
+  uint64_t offset{};
+  DWORD size{};
+  // Bytes the buffer has room for if it's the start of a BlockPool block, 0 otherwise. Backends may register it.
+  DWORD capacity{};
+};
+
+using IoCallbackFn = void(void* ctx, IoRequest* request, DWORD error, size_t bytes_transferred);
+
+// A file bound to an IO backend
+class IoFile {
+protected:
+  HANDLE _handle;
+  DWORD _volume_serial;
+  IoCallbackFn* _callback;
+  void* _ctx;
+
+public:
+  IoFile(HANDLE handle, DWORD volume_serial, IoCallbackFn* callback, void* ctx)
+      : _handle(handle)
+      , _volume_serial(volume_serial)
+      , _callback(callback)
+      , _ctx(ctx) {}
+
+  IoFile(const IoFile&) = delete;
+  IoFile(IoFile&&) = delete;
+  IoFile& operator=(const IoFile&) = delete;
+  IoFile& operator=(IoFile&&) = delete;
+
+  virtual ~IoFile() = default;
+
+  // Start reading request->size bytes at request->offset into request->buffer. If this returns ERROR_SUCCESS, the
+  // callback is called exactly once when the read is done, possibly on another thread before this returns.
+  virtual DWORD ReadAsync(IoRequest* request) = 0;
+
+  // Make reads started so far complete soon, most likely with ERROR_OPERATION_ABORTED. Their callbacks are still
+  // called, maybe before this returns.
+  virtual void Cancel() { CancelIoEx(_handle, nullptr); }
+
+  void Complete(IoRequest* request, DWORD error, size_t bytes_transferred) {
+    _callback(_ctx, request, error, bytes_transferred);
+  }
+
+  HANDLE GetHandle() const { return _handle; }
+
+  DWORD GetVolumeSerial() const { return _volume_serial; }
+};
+
+class IoBackend {
+public:
+  virtual ~IoBackend() = default;
+
+  // Returns nullptr and sets last error on failure. The handle must be opened for overlapped IO.
+  virtual std::unique_ptr<IoFile> Open(HANDLE handle, DWORD volume_serial, IoCallbackFn* callback, void* ctx) = 0;
+};
+
+enum IoBackendType : DWORD {
+  // Reads complete on the executor's workers, see Executor::MakeIoBackend()
+  IoBackendType_ThreadPool,
+  IoBackendType_IoRing
+};
+
+// Falls back to the executor's backend for the node if the requested one is not available on this system
+std::unique_ptr<IoBackend> MakeIoBackend(DWORD type, Executor& executor, unsigned node, DWORD queue_depth);
+
+// Completes reads on the thread pool
+std::unique_ptr<IoBackend> MakeThreadPoolIoBackend(PTP_CALLBACK_ENVIRON environ);
+
+// Binds files to the port with key 0. Whoever dequeues a packet of ours completes it through request->file.
+std::unique_ptr<IoBackend> MakeCompletionPortIoBackend(HANDLE port);
+
+// Returns nullptr if I/O rings are not supported by the OS (before Windows 11). Reads complete on the node's workers.
+std::unique_ptr<IoBackend> MakeIoRingBackend(DWORD queue_depth, Executor& executor, unsigned node);
@@ -0,0 +1,420 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "IoBackend.h"
+
+#include "BlockPool.h"
+#include "Executor.h"
+#include "Queues.h"
+
+// I/O rings are only in the Windows 11 SDK headers, and only with a matching target version. We target Windows 7, so
+// declare the parts we use ourselves and look the functions up at runtime.
+namespace {
+  DECLARE_HANDLE(xHIORING);
+
+  enum xIORING_REF_KIND {
+    xIORING_REF_RAW,
+    xIORING_REF_REGISTERED,
+  };
+
+  struct xIORING_HANDLE_REF {
+    xIORING_REF_KIND Kind;
+
+    union {
+      HANDLE Handle;
+      UINT32 Index;
+    } Handle;
+  };
+
+  struct xIORING_REGISTERED_BUFFER {
+    UINT32 BufferIndex;
+    UINT32 Offset;
+  };
+
+  struct xIORING_BUFFER_REF {
+    xIORING_REF_KIND Kind;
+
+    union {
+      void* Address;
+      xIORING_REGISTERED_BUFFER IndexAndOffset;
+    } Buffer;
+  };
+
+  struct xIORING_BUFFER_INFO {
+    void* Address;
+    UINT32 Length;
+  };
+
+  struct xIORING_CREATE_FLAGS {
+    UINT32 Required;
+    UINT32 Advisory;
+  };
+
+  struct xIORING_CQE {
+    UINT_PTR UserData;
+    HRESULT ResultCode;
+    ULONG_PTR Information;
+  };
+
+  constexpr UINT32 xIORING_VERSION_1 = 1;
+  constexpr UINT32 xIOSQE_FLAGS_NONE = 0;
+  constexpr HRESULT xIORING_E_SUBMISSION_QUEUE_FULL = (HRESULT)0x80460002;
+
+  using CreateIoRing_t = HRESULT WINAPI(UINT32 version, xIORING_CREATE_FLAGS flags, UINT32 sq_size, UINT32 cq_size, xHIORING* ring);
+  using CloseIoRing_t = HRESULT WINAPI(xHIORING ring);
+  using SetIoRingCompletionEvent_t = HRESULT WINAPI(xHIORING ring, HANDLE event);
+  using BuildIoRingReadFile_t = HRESULT WINAPI(xHIORING ring, xIORING_HANDLE_REF file, xIORING_BUFFER_REF buffer, UINT32 size, UINT64 offset, UINT_PTR user_data, UINT32 flags);
+  using BuildIoRingRegisterBuffers_t = HRESULT WINAPI(xHIORING ring, UINT32 count, const xIORING_BUFFER_INFO* buffers, UINT_PTR user_data);
+  using SubmitIoRing_t = HRESULT WINAPI(xHIORING ring, UINT32 wait_operations, UINT32 milliseconds, UINT32* submitted);
+  using PopIoRingCompletion_t = HRESULT WINAPI(xHIORING ring, xIORING_CQE* cqe);
+
+  struct IoRingApi {
+    CreateIoRing_t* CreateIoRing{};
+    CloseIoRing_t* CloseIoRing{};
+    SetIoRingCompletionEvent_t* SetIoRingCompletionEvent{};
+    BuildIoRingReadFile_t* BuildIoRingReadFile{};
+    // Optional, reads just pass their buffers raw without it
+    BuildIoRingRegisterBuffers_t* BuildIoRingRegisterBuffers{};
+    SubmitIoRing_t* SubmitIoRing{};
+    PopIoRingCompletion_t* PopIoRingCompletion{};
+
+    IoRingApi() {
+      const auto kernelbase = GetModuleHandleW(L"kernelbase");
+      if (!kernelbase)
+        return;
+      CreateIoRing = (CreateIoRing_t*)(void*)GetProcAddress(kernelbase, "CreateIoRing");
+      CloseIoRing = (CloseIoRing_t*)(void*)GetProcAddress(kernelbase, "CloseIoRing");
+      SetIoRingCompletionEvent = (SetIoRingCompletionEvent_t*)(void*)GetProcAddress(kernelbase, "SetIoRingCompletionEvent");
+      BuildIoRingReadFile = (BuildIoRingReadFile_t*)(void*)GetProcAddress(kernelbase, "BuildIoRingReadFile");
+      BuildIoRingRegisterBuffers = (BuildIoRingRegisterBuffers_t*)(void*)GetProcAddress(kernelbase, "BuildIoRingRegisterBuffers");
+      SubmitIoRing = (SubmitIoRing_t*)(void*)GetProcAddress(kernelbase, "SubmitIoRing");
+      PopIoRingCompletion = (PopIoRingCompletion_t*)(void*)GetProcAddress(kernelbase, "PopIoRingCompletion");
+    }
+
+    bool IsAvailable() const {
+      return CreateIoRing && CloseIoRing && SetIoRingCompletionEvent && BuildIoRingReadFile && SubmitIoRing && PopIoRingCompletion;
+    }
+  };
+
+  const IoRingApi& GetIoRingApi() {
+    static IoRingApi api;
+    return api;
+  }
+
+  DWORD ErrorFromHresult(HRESULT hr) {
+    if (SUCCEEDED(hr))
+      return ERROR_SUCCESS;
+    if (HRESULT_FACILITY(hr) == FACILITY_WIN32)
+      return HRESULT_CODE(hr);
+    if (hr == E_OUTOFMEMORY)
+      return ERROR_NOT_ENOUGH_MEMORY;
+    return ERROR_GEN_FAILURE;
+  }
+
+  class IoRingBackend;
+
+  class IoRingFile : public IoFile {
+    IoRingBackend* _backend;
+
+  public:
+    IoRingFile(IoRingBackend* backend, HANDLE handle, DWORD volume_serial, IoCallbackFn* callback, void* ctx)
+        : IoFile(handle, volume_serial, callback, ctx)
+        , _backend(backend) {}
+
+    DWORD ReadAsync(IoRequest* request) override;
+
+    void Cancel() override;
+  };
+
+  // All ring operations happen on a single thread, other threads only hand requests over to it. Which files get to
+  // read and how much each device has going on is up to the engine's device queues, all we do here is keep the reads in
+  // flight below what the completion queue can hold. Everything built between two wakeups is submitted in one batch.
+  //
+  // Completions are handed to the executor's workers, so that the ring thread only ever moves requests in and out of
+  // the ring, and hashing a block never holds up the next submission.
+  //
+  // Blocks are registered with the ring as they come by, so the kernel doesn't have to probe and lock the pages for
+  // every read. An address only stays valid until the pool gives memory back to the system, after which it may come
+  // back as a different block, so then we start over.
+  class IoRingBackend : public IoBackend {
+    static constexpr UINT32 k_submission_queue_size = 256;
+    static constexpr UINT32 k_completion_queue_size = 512;
+    static constexpr size_t k_max_registered_buffers = 4096;
+
+    // Requests are pointers, so this never collides with their user data. The rest is the table generation.
+    static constexpr UINT_PTR k_registration_tag = 1;
+
+    struct Completion {
+      IoRequest* request;
+      DWORD error;
+      size_t bytes_transferred;
+    };
+
+    const IoRingApi& _api;
+    xHIORING _ring{};
+    HANDLE _completion_event{};
+    HANDLE _submit_event{};
+    DWORD _max_in_flight;
+
+    std::mutex _mutex;
+    std::deque<IoRequest*> _waiting;
+    DWORD _in_flight{};
+
+    std::unique_ptr<ExecutorWork> _complete_work;
+    moodycamel::ConcurrentQueue<Completion> _completions;
+
+    // Only touched by the ring thread
+    std::unordered_map<const uint8_t*, UINT32> _buffer_indices;
+    std::vector<xIORING_BUFFER_INFO> _buffers;
+    uint64_t _buffers_releases{};
+    UINT_PTR _buffers_generation{};
+    // The kernel knows about this many of the buffers, and will about the rest of _registering once that completes
+    UINT32 _registered{};
+    std::vector<xIORING_BUFFER_INFO> _registering;
+    bool _registration_in_flight{};
+
+    std::atomic<bool> _stop{};
+    std::thread _thread;
+
+    static void CompleteWorkCallback(void* ctx) {
+      const auto self = static_cast<IoRingBackend*>(ctx);
+      // One is submitted for every completion, but with more than one producer the queue may not show ours yet while
+      // it shows a later one. Whoever gets here drains everything, so nothing is left behind by a callback that found
+      // the queue empty.
+      for (Completion completion{}; self->_completions.try_dequeue(completion);)
+        completion.request->file->Complete(completion.request, completion.error, completion.bytes_transferred);
+    }
+
+    void PostCompletion(IoRequest* request, DWORD error, size_t bytes_transferred) {
+      if (!_completions.enqueue({request, error, bytes_transferred})) {
+        request->file->Complete(request, error, bytes_transferred);
+        return;
+      }
+      _complete_work->Submit();
+    }
+
+    xIORING_BUFFER_REF BufferRef(const IoRequest* request) {
+      xIORING_BUFFER_REF ref{};
+      const auto it = _buffer_indices.find(request->buffer);
+      if (it != _buffer_indices.end()) {
+        if (it->second < _registered && request->size <= _buffers[it->second].Length) {
+          ref.Kind = xIORING_REF_REGISTERED;
+          ref.Buffer.IndexAndOffset = {it->second, 0};
+          return ref;
+        }
+      } else if (_api.BuildIoRingRegisterBuffers && request->capacity != 0
+                 && _buffers.size() < k_max_registered_buffers) {
+        // Goes with the next registration, raw until then
+        _buffer_indices.emplace(request->buffer, (UINT32)_buffers.size());
+        _buffers.push_back({request->buffer, (UINT32)request->capacity});
+      }
+      ref.Kind = xIORING_REF_RAW;
+      ref.Buffer.Address = request->buffer;
+      return ref;
+    }
+
+    // Has to be called for every request after it was taken from _waiting. Its block was allocated before it was
+    // queued, so any release that could have handed out the same address before is visible by then.
+    void CheckRegisteredBuffers() {
+      const auto releases = BlockPool::GetReleaseCount();
+      if (releases == _buffers_releases)
+        return;
+      // A registration in flight completes for a generation nobody uses anymore
+      _buffers_releases = releases;
+      ++_buffers_generation;
+      _buffer_indices.clear();
+      _buffers.clear();
+      _registered = 0;
+    }
+
+    void RegisterBuffers() {
+      if (_registration_in_flight || _buffers.size() == _registered)
+        return;
+      // The kernel reads the array when it gets to the operation, so it can't be the one we keep appending to
+      _registering = _buffers;
+      const auto hr = _api.BuildIoRingRegisterBuffers(
+        _ring,
+        (UINT32)_registering.size(),
+        _registering.data(),
+        (_buffers_generation << 1) | k_registration_tag
+      );
+      _registration_in_flight = SUCCEEDED(hr);
+    }
+
+    void RegistrationCompleted(UINT_PTR user_data, HRESULT hr) {
+      _registration_in_flight = false;
+      if (SUCCEEDED(hr) && (user_data >> 1) == (_buffers_generation & (UINT_PTR_MAX >> 1)))
+        _registered = (UINT32)_registering.size();
+    }
+
+    // Build SQEs for whatever fits into the completion queue, returns requests that could not be started at all
+    std::vector<std::pair<IoRequest*, DWORD>> Pump() {
+      std::vector<std::pair<IoRequest*, DWORD>> failed;
+      {
+        std::lock_guard guard{_mutex};
+        while (!_waiting.empty() && _in_flight < _max_in_flight) {
+          const auto request = _waiting.front();
+          CheckRegisteredBuffers();
+          xIORING_HANDLE_REF file_ref{};
+          file_ref.Kind = xIORING_REF_RAW;
+          file_ref.Handle.Handle = request->file->GetHandle();
+          const auto hr = _api.BuildIoRingReadFile(
+            _ring,
+            file_ref,
+            BufferRef(request),
+            request->size,
+            request->offset,
+            (UINT_PTR)request,
+            xIOSQE_FLAGS_NONE
+          );
+          if (hr == xIORING_E_SUBMISSION_QUEUE_FULL)
+            return failed; // Retry after the next submit
+          _waiting.pop_front();
+          if (FAILED(hr))
+            failed.emplace_back(request, ErrorFromHresult(hr));
+          else
+            ++_in_flight;
+        }
+      }
+      RegisterBuffers();
+      return failed;
+    }
+
+    void Run() {
+      const HANDLE events[]{_completion_event, _submit_event};
+      while (!_stop) {
+        WaitForMultipleObjects((DWORD)std::size(events), events, FALSE, INFINITE);
+
+        xIORING_CQE cqe{};
+        while (_api.PopIoRingCompletion(_ring, &cqe) == S_OK) {
+          if (cqe.UserData & k_registration_tag) {
+            RegistrationCompleted(cqe.UserData, cqe.ResultCode);
+            continue;
+          }
+          const auto request = (IoRequest*)cqe.UserData;
+          {
+            std::lock_guard guard{_mutex};
+            --_in_flight;
+          }
+          PostCompletion(request, ErrorFromHresult(cqe.ResultCode), cqe.Information);
+        }
+
+        for (const auto& [request, error] : Pump())
+          PostCompletion(request, error, 0);
+
+        _api.SubmitIoRing(_ring, 0, 0, nullptr);
+      }
+    }
+
+  public:
+    IoRingBackend(const IoRingApi& api, DWORD queue_depth)
+        : _api(api)
+        , _max_in_flight(std::clamp<DWORD>(queue_depth, 1, k_completion_queue_size)) {}
+
+    ~IoRingBackend() override {
+      if (_thread.joinable()) {
+        _stop = true;
+        SetEvent(_submit_event);
+        _thread.join();
+      }
+      if (_ring)
+        _api.CloseIoRing(_ring);
+      if (_completion_event)
+        CloseHandle(_completion_event);
+      if (_submit_event)
+        CloseHandle(_submit_event);
+    }
+
+    bool Initialize(Executor& executor, unsigned node) {
+      _complete_work = executor.CreateWork(CompleteWorkCallback, this, node);
+      if (!_complete_work)
+        return false;
+
+      _completion_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+      _submit_event = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+      if (!_completion_event || !_submit_event)
+        return false;
+
+      const auto hr = _api.CreateIoRing(
+        xIORING_VERSION_1,
+        {},
+        k_submission_queue_size,
+        k_completion_queue_size,
+        &_ring
+      );
+      if (FAILED(hr)) {
+        _ring = nullptr;
+        return false;
+      }
+
+      if (FAILED(_api.SetIoRingCompletionEvent(_ring, _completion_event)))
+        return false;
+
+      _buffers_releases = BlockPool::GetReleaseCount();
+      _thread = std::thread([this] { Run(); });
+      return true;
+    }
+
+    void Enqueue(IoRequest* request) {
+      {
+        std::lock_guard guard{_mutex};
+        _waiting.push_back(request);
+      }
+      SetEvent(_submit_event);
+    }
+
+    // Fail the file's reads that are still waiting for room in the ring, rather than have the cancel wait until the
+    // ring gets to them
+    void Cancel(const IoFile* file) {
+      std::vector<IoRequest*> aborted;
+      {
+        std::lock_guard guard{_mutex};
+        const auto it = std::stable_partition(_waiting.begin(), _waiting.end(), [file](const IoRequest* request) {
+          return request->file != file;
+        });
+        aborted.assign(it, _waiting.end());
+        _waiting.erase(it, _waiting.end());
+      }
+      for (const auto request : aborted)
+        PostCompletion(request, ERROR_OPERATION_ABORTED, 0);
+    }
+
+    std::unique_ptr<IoFile> Open(HANDLE handle, DWORD volume_serial, IoCallbackFn* callback, void* ctx) override {
+      return std::make_unique<IoRingFile>(this, handle, volume_serial, callback, ctx);
+    }
+  };
+
+  DWORD IoRingFile::ReadAsync(IoRequest* request) {
+    request->file = this;
+    _backend->Enqueue(request);
+    return ERROR_SUCCESS;
+  }
+
+  void IoRingFile::Cancel() {
+    _backend->Cancel(this);
+    // The ones in the ring are reads on the handle like any other
+    IoFile::Cancel();
+  }
+} // namespace
+
+std::unique_ptr<IoBackend> MakeIoRingBackend(DWORD queue_depth, Executor& executor, unsigned node) {
+  const auto& api = GetIoRingApi();
+  if (!api.IsAvailable())
+    return nullptr;
+  auto backend = std::make_unique<IoRingBackend>(api, queue_depth);
+  if (!backend->Initialize(executor, node))
+    return nullptr;
+  return backend;
+}
@@ -299,7 +299,15 @@ void MainDialog::UpdateDefaultStatus(bool force_reset) {
 
   if (!_temporary_status) {
     const auto msg = _finished ? IDS_DONE : IDS_PROCESSING;
-    SetWindowTextW(_hwnd_STATIC_PROCESSING, utl::GetString(msg).c_str());
+    auto text = utl::GetString(msg);
+    if (!_finished && _progress.files + _progress.bytes != 0)
+      text += L" " + utl::FormatString(
+        utl::GetString(IDS_PROGRESS).c_str(),
+        _progress.files,
+        _prop_page->GetFiles().size(),
+        _progress.bytes_per_second / (1 << 20)
+      );
+    SetWindowTextW(_hwnd_STATIC_PROCESSING, text.c_str());
   }
 }
 
@@ -313,8 +321,8 @@ INT_PTR MainDialog::DlgProc(UINT msg, WPARAM wparam, LPARAM lparam) {
     { &MainDialog::OnNeedAdjust,        WM_WINDOWPOSCHANGING },
     { &MainDialog::OnNeedAdjust,        WM_WINDOWPOSCHANGED },
     { &MainDialog::OnAllFilesFinished,  wnd::WM_USER_ALL_FILES_FINISHED, wnd::Match_w, wnd::k_user_magic_wparam },
-    { &MainDialog::OnFileProgress,      wnd::WM_USER_FILE_PROGRESS, wnd::Match_w, wnd::k_user_magic_wparam },
     { &MainDialog::OnStatusUpdateTimer, WM_TIMER,   wnd::Match_w,   k_status_update_timer_id },
+    { &MainDialog::OnProgressTimer,     WM_TIMER,   wnd::Match_w,   k_progress_timer_id },
     { &MainDialog::OnHashListNotify,    WM_NOTIFY,  wnd::Match_w,   IDC_HASH_LIST },
     { &MainDialog::OnHashEditChanged,   WM_COMMAND, wnd::Match_wlh, MAKELONG(IDC_EDIT_HASH, EN_CHANGE) },
     { &MainDialog::OnClipboardClicked,  WM_COMMAND, wnd::Match_wlh, MAKELONG(IDC_BUTTON_CLIPBOARD, BN_CLICKED) },
@@ -411,6 +419,9 @@ INT_PTR MainDialog::OnInitDialog(UINT, WPARAM, LPARAM) {
 
   _prop_page->ProcessFiles();
 
+  // Hashing threads don't tell us about progress, we go and look
+  SetTimer(_hwnd, k_progress_timer_id, _prop_page->settings.progress_interval, nullptr);
+
   return FALSE;
 }
 
@@ -455,6 +466,7 @@ INT_PTR MainDialog::OnAllFilesFinished(UINT, WPARAM, LPARAM) {
     FileFinished(file.get());
 
   _finished = true;
+  KillTimer(_hwnd, k_progress_timer_id);
 
   // We only enable settings button after processing is done because changing enabled algorithms could result
   // in much more problems
@@ -490,8 +502,15 @@ INT_PTR MainDialog::OnAllFilesFinished(UINT, WPARAM, LPARAM) {
   return FALSE;
 }
 
-INT_PTR MainDialog::OnFileProgress(UINT, WPARAM, LPARAM lparam) {
-  SendMessageW(_hwnd_PROGRESS, PBM_SETPOS, (WPARAM)lparam, 0);
+INT_PTR MainDialog::OnProgressTimer(UINT, WPARAM, LPARAM) {
+  _progress = _prop_page->SampleProgress();
+
+  if (const auto total = _prop_page->GetSizeTotal()) {
+    const auto part = std::min(_progress.bytes, total) * Coordinator::k_progress_resolution / total;
+    SendMessageW(_hwnd_PROGRESS, PBM_SETPOS, (WPARAM)part, 0);
+  }
+
+  UpdateDefaultStatus();
   return FALSE;
 }
 
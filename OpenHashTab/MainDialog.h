@@ -15,6 +15,7 @@
 //    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 #include "hash_colors.h"
+#include "Progress.h"
 #include "utl.h"
 #include "wnd.h"
 
@@ -24,6 +25,7 @@ class Coordinator;
 
 class MainDialog {
   static constexpr auto k_status_update_timer_id = (UINT_PTR)0x7c253816f7ef92ea;
+  static constexpr auto k_progress_timer_id = (UINT_PTR)0x3d9a6f0b52e4c817;
 
   enum ColIndex : int {
     ColIndex_Filename,
@@ -64,6 +66,8 @@ class MainDialog {
 
   bool _temporary_status{};
   bool _finished{};
+  // Last progress sample, shown in the default status while processing
+  ProgressAggregator::Sample _progress{};
   // volatile because reentrancy, and clang-tidy doesn't recognize that
   volatile bool _inhibit_reformat{};
   HashColorType _check_against_color{HashColorType::Unknown};
@@ -91,8 +95,8 @@ public:
 private:
   INT_PTR OnInitDialog(UINT, WPARAM, LPARAM);
   INT_PTR OnAllFilesFinished(UINT, WPARAM, LPARAM);
-  INT_PTR OnFileProgress(UINT, WPARAM, LPARAM lparam);
   INT_PTR OnStatusUpdateTimer(UINT, WPARAM, LPARAM);
+  INT_PTR OnProgressTimer(UINT, WPARAM, LPARAM);
   INT_PTR OnHashListNotify(UINT, WPARAM, LPARAM lparam);
   INT_PTR OnExportClicked(UINT, WPARAM, LPARAM);
   INT_PTR OnCancelClicked(UINT, WPARAM, LPARAM);
@@ -0,0 +1,44 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "Progress.h"
+
+std::atomic<size_t> ProgressAggregator::s_next_slot;
+
+ProgressAggregator::Slot& ProgressAggregator::ThreadSlot(Slot* slots) {
+  // Same for every aggregator, a thread only ever counts for one at a time anyway
+  thread_local const auto slot = s_next_slot.fetch_add(1, std::memory_order_relaxed) % k_slots;
+  return slots[slot];
+}
+
+ProgressAggregator::Sample ProgressAggregator::TakeSample() {
+  Sample sample{};
+  for (const auto& slot : _slots) {
+    sample.bytes += slot.bytes.load(std::memory_order_relaxed);
+    sample.files += slot.files.load(std::memory_order_relaxed);
+  }
+
+  LARGE_INTEGER frequency{}, now{};
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+
+  if (_last_ticks != 0 && now.QuadPart > _last_ticks)
+    sample.bytes_per_second = (double)(sample.bytes - _last_bytes) * (double)frequency.QuadPart
+                              / (double)(now.QuadPart - _last_ticks);
+
+  _last_bytes = sample.bytes;
+  _last_ticks = now.QuadPart;
+  return sample;
+}
@@ -0,0 +1,60 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+// Bytes hashed and files finished, counted by whoever did the work and only summed up when someone looks, like the
+// window's progress timer. Counting is a relaxed add to a slot hardly any other thread uses, so workers reporting
+// progress never take a lock or fight over a cache line.
+class ProgressAggregator {
+public:
+  struct Sample {
+    uint64_t bytes;
+    uint64_t files;
+    // Since the previous sample, 0 for the first one
+    double bytes_per_second;
+  };
+
+private:
+  // Threads get a slot each in the order they first count something, and share them beyond this many
+  static constexpr size_t k_slots = 64;
+
+  static std::atomic<size_t> s_next_slot;
+
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> files;
+  };
+
+  Slot _slots[k_slots]{};
+
+  // Sample() only
+  uint64_t _last_bytes{};
+  int64_t _last_ticks{};
+
+  static Slot& ThreadSlot(Slot* slots);
+
+public:
+  void AddBytes(uint64_t bytes) {
+    ThreadSlot(_slots).bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void AddFile() {
+    ThreadSlot(_slots).files.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Only from one thread at a time, as it keeps the previous sample for the rate
+  Sample TakeSample();
+};
@@ -22,8 +22,3 @@
 #pragma clang diagnostic ignored "-Wsign-conversion"
 #include <blockingconcurrentqueue.h>
 #pragma clang diagnostic pop
-
-
-class FileHashTask;
-
-extern moodycamel::ConcurrentQueue<FileHashTask*> g_read_queue;
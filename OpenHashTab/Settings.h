@@ -93,6 +93,29 @@ struct Settings {
   RegistrySetting<bool> hash_sumfile_too{"HashSumfileToo", false};
   RegistrySetting<bool> sumfile_algorithm_only{"SumfileAlgorithmOnly", true};
 
+  // Hashing engine tuning, no UI for these
+  RegistrySetting<DWORD> io_backend{"IoBackend", 0};                  // see IoBackendType
+  RegistrySetting<DWORD> io_queue_depth{"IoQueueDepth", 32};          // max reads in flight, I/O ring only
+  RegistrySetting<DWORD> read_mode{"ReadMode", 0};                    // see ReadMode
+  RegistrySetting<DWORD> mapped_max_size{"MappedMaxSize", 0};         // MB, largest file ReadMode_Auto maps, 0 none
+  RegistrySetting<DWORD> direct_min_size{"DirectMinSize", 0};         // MB, smallest file Auto reads direct, 0 never
+  RegistrySetting<DWORD> block_size{"BlockSize", 0};                  // KB, rounded up to a block size, 0 per file
+  RegistrySetting<DWORD> rotational_files{"RotationalFiles", 1};      // files read at once per rotational drive, 0 any
+  RegistrySetting<DWORD> small_file_size{"SmallFileSize", 64};        // KB, largest file hashed inline, 0 never
+  RegistrySetting<DWORD> buffer_memory{"BufferMemory", 0};            // MB, most memory for read buffers, 0 no limit
+  RegistrySetting<DWORD> read_ahead{"ReadAhead", 2};                  // blocks per file reading or waiting to hash
+  RegistrySetting<DWORD> cache_hint{"CacheHint", 1};                  // see CacheHint
+  RegistrySetting<DWORD> start_order{"StartOrder", 0};                // see StartOrder
+  RegistrySetting<DWORD> hash_scheduler{"HashScheduler", 0};          // see HashSchedulerType
+  RegistrySetting<DWORD> stage_depth{"StageDepth", 4};                // blocks read ahead per hash worker, 0 no limit
+  RegistrySetting<DWORD> executor{"Executor", 0};                     // see ExecutorType
+  RegistrySetting<DWORD> worker_count{"WorkerCount", 0};              // threads hashing and completing reads, 0 default
+  RegistrySetting<DWORD> worker_affinity{"WorkerAffinity", 0};        // processor mask to pin workers to, 0 none
+  RegistrySetting<bool> numa{"Numa", false};                          // split workers, files and blocks by NUMA node
+  RegistrySetting<bool> large_pages{"LargePages", false};             // back 2 and 8 MB blocks with large pages
+  RegistrySetting<bool> skip_holes{"SkipHoles", true};                // hash holes of sparse files without reading them
+  RegistrySetting<DWORD> progress_interval{"ProgressInterval", 100};  // ms between progress updates of the window
+
   // Following are the color settings. Defaults:
   //
   // No hash to compare to  - system colors
@@ -0,0 +1,211 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#include "StageController.h"
+
+std::atomic<size_t> StageController::s_target;
+StageController::Counter StageController::s_depth[Stage_Count];
+StageController::Counter StageController::s_max_depth[Stage_Count];
+StageController::Counter StageController::s_throttled;
+std::atomic<bool> StageController::s_holding_back;
+std::mutex StageController::s_mutex;
+std::vector<size_t> StageController::s_targets;
+size_t StageController::s_asked_target;
+PTP_TIMER StageController::s_sampler;
+int64_t StageController::s_last_sample;
+int64_t StageController::s_read_stall_ticks;
+int64_t StageController::s_hash_stall_ticks;
+size_t StageController::s_min_target;
+size_t StageController::s_max_target;
+StageController::Window StageController::s_window;
+
+int64_t StageController::Now() {
+  LARGE_INTEGER now{};
+  QueryPerformanceCounter(&now);
+  return now.QuadPart;
+}
+
+void StageController::UpdateMaxDepth(Stage stage, size_t depth) {
+  // Only contended while the maximum is still climbing
+  auto& max = s_max_depth[stage].value;
+  auto current = max.load(std::memory_order_relaxed);
+  while (depth > current && !max.compare_exchange_weak(current, depth, std::memory_order_relaxed)) {}
+}
+
+VOID NTAPI StageController::SampleCallback(PTP_CALLBACK_INSTANCE instance, PVOID ctx, PTP_TIMER timer) {
+  UNREFERENCED_PARAMETER(instance);
+  UNREFERENCED_PARAMETER(ctx);
+  UNREFERENCED_PARAMETER(timer);
+  std::lock_guard lock{s_mutex};
+  Sample();
+}
+
+void StageController::Sample() {
+  // Whatever we see now is taken to have lasted since the last sample
+  const auto now = Now();
+  const auto elapsed = now - s_last_sample;
+  s_last_sample = now;
+
+  const auto held_back = s_holding_back.load(std::memory_order_relaxed);
+  const auto reading = s_depth[Stage_Reading].value.load(std::memory_order_relaxed);
+  const auto waiting = s_depth[Stage_Waiting].value.load(std::memory_order_relaxed);
+  const auto hashing = s_depth[Stage_Hashing].value.load(std::memory_order_relaxed);
+  const auto starved = reading != 0 && waiting == 0 && hashing == 0;
+
+  if (held_back)
+    s_read_stall_ticks += elapsed;
+  if (starved)
+    s_hash_stall_ticks += elapsed;
+
+  ++s_window.samples;
+  s_window.held_back += held_back;
+  s_window.starved += starved;
+  s_window.fed += waiting != 0;
+  if (s_window.samples == k_adjust_samples) {
+    Adjust();
+    s_window = {};
+  }
+}
+
+void StageController::Adjust() {
+  // Only matters while it holds reads back
+  const auto target = s_target.load(std::memory_order_relaxed);
+  if (target == 0 || s_window.held_back == 0)
+    return;
+
+  if (s_window.starved != 0)
+    SetTarget(target + std::max<size_t>(target / 4, 1));
+  else if (s_window.fed == s_window.samples)
+    SetTarget(target - std::max<size_t>(target / 8, 1));
+}
+
+void StageController::SetTarget(size_t target) {
+  if (s_asked_target == 0) {
+    target = 0;
+  } else {
+    const auto min = std::max<size_t>(s_asked_target / k_min_target_divisor, 1);
+    target = std::clamp(target, min, s_asked_target * k_max_target_multiplier);
+  }
+  s_target.store(target, std::memory_order_relaxed);
+  s_min_target = std::min(s_min_target, target);
+  s_max_target = std::max(s_max_target, target);
+}
+
+PTP_TIMER StageController::UpdateForTargets() {
+  const auto asked = s_targets.empty() ? 0 : *std::max_element(s_targets.begin(), s_targets.end());
+  s_asked_target = asked == SIZE_MAX ? 0 : asked;
+  // Keep what was learned so far, if it's still in range
+  const auto target = s_target.load(std::memory_order_relaxed);
+  SetTarget(target != 0 ? target : s_asked_target);
+
+  if (s_targets.empty())
+    return std::exchange(s_sampler, nullptr);
+
+  // Without a timer there are just no stalls to report, and the target stays where it is
+  if (!s_sampler) {
+    s_sampler = CreateThreadpoolTimer(SampleCallback, nullptr, nullptr);
+    if (s_sampler) {
+      s_last_sample = Now();
+      s_window = {};
+      // Relative, in 100 ns units
+      const auto due_ticks = (uint64_t)-((int64_t)k_sample_period_ms * 10000);
+      FILETIME due{(DWORD)due_ticks, (DWORD)(due_ticks >> 32)};
+      SetThreadpoolTimer(s_sampler, &due, k_sample_period_ms, 0);
+    }
+  }
+  return nullptr;
+}
+
+void StageController::AddTarget(size_t blocks) {
+  std::lock_guard lock{s_mutex};
+  s_targets.push_back(blocks ? blocks : SIZE_MAX);
+  UpdateForTargets();
+}
+
+void StageController::RemoveTarget(size_t blocks) {
+  PTP_TIMER sampler;
+  {
+    std::lock_guard lock{s_mutex};
+    const auto it = std::find(s_targets.begin(), s_targets.end(), blocks ? blocks : SIZE_MAX);
+    assert(it != s_targets.end());
+    if (it != s_targets.end())
+      s_targets.erase(it);
+    sampler = UpdateForTargets();
+  }
+  // Without the lock, a callback in progress needs it to finish
+  if (sampler) {
+    SetThreadpoolTimer(sampler, nullptr, 0, 0);
+    WaitForThreadpoolTimerCallbacks(sampler, TRUE);
+    CloseThreadpoolTimer(sampler);
+  }
+}
+
+bool StageController::TryStartRead() {
+  // Take the place first, so that racing readers can't all squeeze in under the target
+  const auto reading = s_depth[Stage_Reading].value.fetch_add(1, std::memory_order_relaxed) + 1;
+  const auto target = s_target.load(std::memory_order_relaxed);
+  if (target && reading + s_depth[Stage_Waiting].value.load(std::memory_order_relaxed) > target) {
+    s_depth[Stage_Reading].value.fetch_sub(1, std::memory_order_relaxed);
+    s_throttled.value.fetch_add(1, std::memory_order_relaxed);
+    if (!s_holding_back.load(std::memory_order_relaxed))
+      s_holding_back.store(true, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Only written when it changes, everyone hashing reads it
+  if (s_holding_back.load(std::memory_order_relaxed))
+    s_holding_back.store(false, std::memory_order_relaxed);
+  UpdateMaxDepth(Stage_Reading, reading);
+  return true;
+}
+
+void StageController::Move(Stage from, Stage to) {
+  if (from != Stage_None)
+    s_depth[from].value.fetch_sub(1, std::memory_order_relaxed);
+  if (to != Stage_None)
+    UpdateMaxDepth(to, s_depth[to].value.fetch_add(1, std::memory_order_relaxed) + 1);
+}
+
+void StageController::StartStats() {
+  std::lock_guard lock{s_mutex};
+  for (auto i = 0u; i < Stage_Count; ++i)
+    s_max_depth[i].value = s_depth[i].value.load(std::memory_order_relaxed);
+  s_throttled.value = 0;
+  s_read_stall_ticks = 0;
+  s_hash_stall_ticks = 0;
+  s_last_sample = Now();
+  s_min_target = s_max_target = s_target.load(std::memory_order_relaxed);
+}
+
+StageController::Stats StageController::StopStats() {
+  LARGE_INTEGER frequency{};
+  QueryPerformanceFrequency(&frequency);
+
+  std::lock_guard lock{s_mutex};
+  if (s_sampler)
+    Sample();
+  Stats stats{};
+  for (auto i = 0u; i < Stage_Count; ++i) {
+    stats.depth[i] = s_depth[i].value.load(std::memory_order_relaxed);
+    stats.max_depth[i] = s_max_depth[i].value.load(std::memory_order_relaxed);
+  }
+  stats.throttled = s_throttled.value.load(std::memory_order_relaxed);
+  stats.target = s_target.load(std::memory_order_relaxed);
+  stats.min_target = s_min_target;
+  stats.max_target = s_max_target;
+  stats.read_stall_seconds = (double)s_read_stall_ticks / (double)frequency.QuadPart;
+  stats.hash_stall_seconds = (double)s_hash_stall_ticks / (double)frequency.QuadPart;
+  return stats;
+}
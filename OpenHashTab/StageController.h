@@ -0,0 +1,134 @@
+//    Copyright 2019-2023 namazso <admin@namazso.eu>
+//    This file is part of OpenHashTab.
+//
+//    OpenHashTab is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    OpenHashTab is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with OpenHashTab.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+// Links the read stage to the hash stage. Every block read into a buffer goes through reading, waiting to be hashed
+// and hashing. New reads are only started while the blocks reading and waiting stay below a target depth scaled to
+// the number of hash workers, so that a slow hash stage doesn't leave most of the budget sitting in queues.
+//
+// The target follows the stalls sampled while anyone is hashing. If hashing starves while reads are held back, the
+// reads take longer than the depth covers and the target grows. If blocks were waiting to be hashed all along, reads
+// are ahead by more than needed and it shrinks again. It stays within a range around what was asked for.
+class StageController {
+public:
+  enum Stage {
+    Stage_None,
+    Stage_Reading,
+    Stage_Waiting,
+    Stage_Hashing,
+    Stage_Count
+  };
+
+  struct Stats {
+    // Blocks in each stage now, and the most at once since the last reset. Stage_None is unused.
+    size_t depth[Stage_Count];
+    size_t max_depth[Stage_Count];
+    // Reads not started because the target was reached
+    uint64_t throttled;
+    // The target now, and the smallest and largest it was since the last reset. 0 if not limited.
+    size_t target;
+    size_t min_target;
+    size_t max_target;
+    // Time reads were held back, and time there was nothing to hash while reads were in flight, as sampled
+    double read_stall_seconds;
+    double hash_stall_seconds;
+  };
+
+private:
+  // Everything the hot path touches is a relaxed atomic on a line of its own, so reading and hashing threads never wait
+  // for each other here
+  struct alignas(64) Counter {
+    std::atomic<size_t> value;
+  };
+
+  // 0 if not limited
+  static std::atomic<size_t> s_target;
+
+  // The target is kept between a fraction and a multiple of what was asked for
+  static constexpr size_t k_min_target_divisor = 2;
+  static constexpr size_t k_max_target_multiplier = 4;
+
+  static Counter s_depth[Stage_Count];
+  static Counter s_max_depth[Stage_Count];
+  static Counter s_throttled;
+
+  // Whether the last read asked for was held back
+  static std::atomic<bool> s_holding_back;
+
+  // Guards the targets and the stall sampling, neither is on the hot path
+  static std::mutex s_mutex;
+
+  // Targets of everyone currently hashing, see AddTarget(). SIZE_MAX for no limit.
+  static std::vector<size_t> s_targets;
+
+  // Largest of s_targets, which the adjusted target is kept around. 0 if not limited.
+  static size_t s_asked_target;
+
+  // Stalls are sampled on a timer while anyone is hashing, so that the hot path never reads the clock. Short stalls
+  // between samples are missed or rounded up to a whole period.
+  static constexpr DWORD k_sample_period_ms = 5;
+  static PTP_TIMER s_sampler;
+  static int64_t s_last_sample;
+  static int64_t s_read_stall_ticks;
+  static int64_t s_hash_stall_ticks;
+  static size_t s_min_target;
+  static size_t s_max_target;
+
+  // The target is adjusted once every this many samples, from what they saw
+  static constexpr unsigned k_adjust_samples = 20;
+  struct Window {
+    unsigned samples;
+    unsigned held_back;
+    unsigned starved;
+    unsigned fed;
+  };
+  static Window s_window;
+
+  static int64_t Now();
+
+  static void UpdateMaxDepth(Stage stage, size_t depth);
+
+  static VOID NTAPI SampleCallback(PTP_CALLBACK_INSTANCE instance, PVOID ctx, PTP_TIMER timer);
+
+  // With the lock held
+  static void Sample();
+  static void Adjust();
+  static void SetTarget(size_t target);
+
+  // With the lock held, returns the timer to close without it once the last target is gone
+  static PTP_TIMER UpdateForTargets();
+
+public:
+  // Blocks reading or waiting to be hashed at most, 0 for no limit. Everyone hashing adds theirs, and the target is
+  // adjusted around the largest one until they remove it again with the same number.
+  static void AddTarget(size_t blocks);
+  static void RemoveTarget(size_t blocks);
+
+  // Stage_None to Stage_Reading, unless that would go over the target
+  static bool TryStartRead();
+
+  // Move a block between stages, Stage_None when it leaves
+  static void Move(Stage from, Stage to);
+
+  // Whether the last read asked for was held back, someone should look at the read queues when hashing moves on
+  static bool IsThrottled() { return s_holding_back.load(std::memory_order_relaxed); }
+
+  // Reset everything but the current depths and the target
+  static void StartStats();
+
+  // What was collected since StartStats(). Stalls are only sampled while a target is added.
+  static Stats StopStats();
+};
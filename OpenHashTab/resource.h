@@ -134,3 +134,4 @@
 #define IDS_VT_NO_COMPATIBLE               452
 #define IDS_DISPLAY_MONOSPACE              453
 #define IDS_SUMMARY                        454
+#define IDS_PROGRESS                       455
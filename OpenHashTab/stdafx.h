@@ -73,7 +73,9 @@
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <coroutine>
 #include <cstdint>
+#include <deque>
 #include <list>
 #include <memory>
 #include <mutex>
@@ -81,6 +83,7 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
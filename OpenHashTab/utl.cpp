@@ -197,18 +197,145 @@ std::wstring utl::MakePathLongCompatible(std::wstring file) {
   return file;
 }
 
-HANDLE utl::OpenForRead(const std::wstring& file, bool async) {
+HANDLE utl::OpenForRead(const std::wstring& file, bool async, bool sequential) {
   return CreateFileW(
     MakePathLongCompatible(file).c_str(),
     GENERIC_READ,
     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
     nullptr,
     OPEN_EXISTING,
-    FILE_ATTRIBUTE_NORMAL | (async ? FILE_FLAG_OVERLAPPED : 0),
+    FILE_ATTRIBUTE_NORMAL | (async ? FILE_FLAG_OVERLAPPED : 0) | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0),
     nullptr
   );
 }
 
+DWORD utl::GetSectorSize(HANDLE file) {
+  // FILE_STORAGE_INFO is Windows 8+
+  struct xFILE_STORAGE_INFO {
+    ULONG LogicalBytesPerSector;
+    ULONG PhysicalBytesPerSectorForAtomicity;
+    ULONG PhysicalBytesPerSectorForPerformance;
+    ULONG FileSystemEffectivePhysicalBytesPerSectorForAtomicity;
+    ULONG Flags;
+    ULONG ByteOffsetForSectorAlignment;
+    ULONG ByteOffsetForPartitionAlignment;
+  };
+
+  static constexpr auto FileStorageInfo = static_cast<FILE_INFO_BY_HANDLE_CLASS>(16);
+
+  xFILE_STORAGE_INFO fsi{};
+  if (GetFileInformationByHandleEx(file, FileStorageInfo, &fsi, sizeof(fsi)))
+    return fsi.LogicalBytesPerSector;
+
+  // Windows 7, or a file system that can't tell. Guessing could fail every unbuffered read, let the caller fall back
+  return 0;
+}
+
+bool utl::GetAllocatedRanges(HANDLE file, uint64_t size, std::vector<std::pair<uint64_t, uint64_t>>& ranges) {
+  ranges.clear();
+
+  FILE_ALLOCATED_RANGE_BUFFER query{};
+  query.Length.QuadPart = (LONGLONG)size;
+
+  while (true) {
+    FILE_ALLOCATED_RANGE_BUFFER out[64];
+    OVERLAPPED overlapped{};
+    DWORD returned{};
+    auto ret = DeviceIoControl(
+      file,
+      FSCTL_QUERY_ALLOCATED_RANGES,
+      &query,
+      sizeof(query),
+      out,
+      sizeof(out),
+      nullptr,
+      &overlapped
+    );
+    if (ret || GetLastError() == ERROR_IO_PENDING || GetLastError() == ERROR_MORE_DATA)
+      ret = GetOverlappedResult(file, &overlapped, &returned, TRUE);
+
+    // More ranges than fit in the buffer, the ones that did are still filled in
+    const auto more = !ret && GetLastError() == ERROR_MORE_DATA;
+    if (!ret && !more) {
+      ranges.clear();
+      return false;
+    }
+
+    const auto count = returned / sizeof(*out);
+    for (auto i = 0u; i < count; ++i)
+      ranges.emplace_back((uint64_t)out[i].FileOffset.QuadPart, (uint64_t)out[i].Length.QuadPart);
+
+    if (!more || count == 0)
+      return true;
+
+    const auto end = ranges.back().first + ranges.back().second;
+    if (end >= size)
+      return true;
+    query.FileOffset.QuadPart = (LONGLONG)end;
+    query.Length.QuadPart = (LONGLONG)(size - end);
+  }
+}
+
+struct xWIN32_MEMORY_RANGE_ENTRY {
+  PVOID VirtualAddress;
+  SIZE_T NumberOfBytes;
+};
+
+using PrefetchVirtualMemory_t = BOOL WINAPI(HANDLE process, ULONG_PTR count, xWIN32_MEMORY_RANGE_ENTRY* entries, ULONG flags);
+
+static PrefetchVirtualMemory_t* GetPrefetchVirtualMemory() {
+  static const auto pfn = [] {
+    const auto kernel32 = GetModuleHandleW(L"kernel32");
+    return kernel32 ? (PrefetchVirtualMemory_t*)(void*)GetProcAddress(kernel32, "PrefetchVirtualMemory") : nullptr;
+  }();
+  return pfn;
+}
+
+bool utl::CanPrefetchMemory() {
+  return GetPrefetchVirtualMemory() != nullptr;
+}
+
+void utl::PrefetchMemory(const void* p, size_t size) {
+  if (const auto pfn = GetPrefetchVirtualMemory()) {
+    xWIN32_MEMORY_RANGE_ENTRY entry{const_cast<void*>(p), size};
+    pfn(GetCurrentProcess(), 1, &entry, 0);
+  }
+}
+
+// SetThreadInformation is Windows 8+
+using SetThreadInformation_t = BOOL WINAPI(HANDLE thread, int information_class, PVOID information, DWORD size);
+
+static SetThreadInformation_t* GetSetThreadInformation() {
+  static const auto pfn = [] {
+    const auto kernel32 = GetModuleHandleW(L"kernel32");
+    return kernel32 ? (SetThreadInformation_t*)(void*)GetProcAddress(kernel32, "SetThreadInformation") : nullptr;
+  }();
+  return pfn;
+}
+
+static void SetThreadMemoryPriority(ULONG priority) {
+  static constexpr auto ThreadMemoryPriority = 0;
+
+  if (const auto pfn = GetSetThreadInformation())
+    pfn(GetCurrentThread(), ThreadMemoryPriority, &priority, sizeof(priority));
+}
+
+utl::LowMemoryPriorityScope::LowMemoryPriorityScope(bool enabled)
+    : _enabled{enabled} {
+  static constexpr ULONG k_very_low = 1; // MEMORY_PRIORITY_VERY_LOW
+
+  if (_enabled)
+    SetThreadMemoryPriority(k_very_low);
+}
+
+utl::LowMemoryPriorityScope::~LowMemoryPriorityScope() {
+  // Pool threads start out normal, and that's what other work on them expects
+  static constexpr ULONG k_normal = 5; // MEMORY_PRIORITY_NORMAL
+
+  if (_enabled)
+    SetThreadMemoryPriority(k_normal);
+}
+
 DWORD utl::SetClipboardText(HWND hwnd, std::wstring_view text) {
   DWORD error;
 
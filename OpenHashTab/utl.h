@@ -141,7 +141,35 @@ namespace utl {
 
   std::wstring MakePathLongCompatible(std::wstring file);
 
-  HANDLE OpenForRead(const std::wstring& file, bool async = false);
+  // Sequential hints the file cache to read ahead further and unmap what's behind sooner
+  HANDLE OpenForRead(const std::wstring& file, bool async = false, bool sequential = false);
+
+  // Logical sector size of the device the file is on, 0 if unknown
+  DWORD GetSectorSize(HANDLE file);
+
+  // Offset and length of the ranges of a sparse file that hold data, in order. The rest up to `size` are holes, which
+  // read as zeros. Returns false if the file system can't tell, then assume it's all data. The handle may be
+  // overlapped, but must not be bound to a completion port yet.
+  bool GetAllocatedRanges(HANDLE file, uint64_t size, std::vector<std::pair<uint64_t, uint64_t>>& ranges);
+
+  // PrefetchVirtualMemory is Windows 8+
+  bool CanPrefetchMemory();
+
+  // Hint that the range will be read soon, so that it's brought in with large reads. Does nothing if unsupported.
+  void PrefetchMemory(const void* p, size_t size);
+
+  // While alive, pages this thread brings in go to the lowest priority standby list, so they are repurposed before
+  // anyone else's. Does nothing if not enabled, or before Windows 8.
+  class LowMemoryPriorityScope {
+    bool _enabled;
+
+  public:
+    explicit LowMemoryPriorityScope(bool enabled);
+    ~LowMemoryPriorityScope();
+
+    LowMemoryPriorityScope(const LowMemoryPriorityScope&) = delete;
+    LowMemoryPriorityScope& operator=(const LowMemoryPriorityScope&) = delete;
+  };
 
   DWORD SetClipboardText(HWND hwnd, std::wstring_view text);
 
@@ -21,8 +21,7 @@ namespace wnd {
   static constexpr auto k_user_magic_wparam = (WPARAM)0x1c725fcfdcbf5843;
 
   enum UserWindowMessages : UINT {
-    WM_USER_ALL_FILES_FINISHED = WM_USER,
-    WM_USER_FILE_PROGRESS
+    WM_USER_ALL_FILES_FINISHED = WM_USER
   };
 
 #define MAKE_IDC_MEMBER(hwnd, name) HWND _hwnd_##name = GetDlgItem(hwnd, IDC_##name)